@@ -0,0 +1,70 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "altitude.h"
+
+/*
+ * Compares the fixed point altitude and sea level pressure against the
+ * standard atmosphere formula in double precision over 30 to 110 kPa
+ */
+
+static double reference_altitude(double pressure)
+{
+    return 44330.0 * (1.0 - pow(pressure / 101325.0, 1.0 / 5.255));
+}
+
+static double reference_pressure(double altitude)
+{
+    return 101325.0 * pow(1.0 - altitude / 44330.0, 5.255);
+}
+
+int main(void)
+{
+    int failed = 0;
+    double worst = 0, worst_high = 0;
+    long worst_at = 0;
+
+    for (long p = 30000; p <= 110000; p++) {
+	double error = fabs(altitude_from_pressure(p) / 10.0 - reference_altitude(p));
+	if (error > worst) {
+	    worst = error;
+	    worst_at = p;
+	}
+	if (p >= 70000 && error > worst_high) {
+	    worst_high = error;
+	}
+    }
+    printf("altitude: max error %.2f m at %ld Pa, %.2f m above 70 kPa\n", worst, worst_at, worst_high);
+    failed |= worst > 0.9 || worst_high > 0.25;
+
+    worst = 0;
+    for (long h = -5000; h <= 90000; h++) {
+	double error = fabs(altitude_to_pressure(h) - reference_pressure(h / 10.0));
+	if (error > worst) {
+	    worst = error;
+	    worst_at = h;
+	}
+    }
+    printf("pressure: max error %.2f Pa at %.1f m\n", worst, worst_at / 10.0);
+    failed |= worst > 4.0;
+
+    static const long stations[] = { 0, 1000, 5000, 15000, 30000 };
+    for (unsigned i = 0; i < sizeof(stations) / sizeof(stations[0]); i++) {
+	double station = stations[i] / 10.0;
+	double ratio = 101325.0 / reference_pressure(station);
+
+	altitude_set_station(stations[i]);
+	worst = 0;
+	for (long p = 30000; p * ratio <= 110000; p++) {
+	    double error = fabs(altitude_qnh(p) - p * ratio);
+	    if (error > worst) {
+		worst = error;
+		worst_at = p;
+	    }
+	}
+	printf("qnh at %6.1f m: max error %.2f Pa at %ld Pa\n", station, worst, worst_at);
+	failed |= worst > 4.0;
+    }
+
+    return failed;
+}
@@ -0,0 +1,371 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "bmp180.h"
+#include "bmp180_lanes.h"
+#include "sim.h"
+
+/*
+ * Runs one set of measurements against the simulated BMP180, sleeping until
+ * the next millisecond tick whenever the driver is busy, and prints what it
+ * cost on the bus
+ */
+static int run(const char *name, struct bmp180_context *context, struct bmp180_measurements *measurements, enum bmp180_status expected)
+{
+    double start = sim_time_us();
+    enum bmp180_status status;
+
+    sim_take_stats();
+    bmp180_start(context, measurements);
+    while ((status = bmp180_poll(context)) == BMP180_BUSY) {
+	sim_idle_us(1000 - fmod(sim_time_us(), 1000));
+    }
+
+    struct sim_stats stats = sim_take_stats();
+    printf("%-26s %4u %7lu %6lu %6lu %5lu %9.2f %9.2f", name, measurements->oss,
+	    stats.edges, stats.bytes, stats.transactions, stats.naks,
+	    stats.bus_us / 1000, (sim_time_us() - start) / 1000);
+
+    if (status != expected) {
+	printf("\n");
+	fprintf(stderr, "%s: expected %s\n", name, expected == BMP180_READY ? "measurements" : "an error");
+	return 1;
+    }
+    if (stats.violations) {
+	printf("\n");
+	fprintf(stderr, "%s: %lu periods too short, the first a %s\n", name, stats.violations, stats.violation);
+	return 1;
+    }
+    if (status == BMP180_ERROR) {
+	printf(" %6s %7s\n", "error", "-");
+	return 0;
+    }
+
+    bmp180_complete(context);
+    printf(" %6ld %7ld\n", (long) measurements->temperature, (long) measurements->pressure);
+
+    /*
+     * The model returns the datasheet example values, so the results are
+     * known at the default oversampling setting
+     */
+    if (measurements->oss == 0 && (measurements->temperature != 150 || measurements->pressure != 69964)) {
+	fprintf(stderr, "%s: expected 150 and 69964\n", name);
+	return 1;
+    }
+    return 0;
+}
+
+/*
+ * Measures back to back for a second of simulated time, reusing UT for up to
+ * the given number of measurements, and prints the rate
+ */
+static int stream(const char *name, struct bmp180_context *context, uint8_t samples)
+{
+    struct bmp180_measurements measurements;
+    double start = sim_time_us();
+    unsigned count = 0;
+    int failed = 0;
+
+    bmp180_set_streaming(context, samples, 1000);
+    while (sim_time_us() - start < 1000000) {
+	bmp180_start(context, &measurements);
+	while (bmp180_poll(context) == BMP180_BUSY) {
+	    sim_idle_us(1000 - fmod(sim_time_us(), 1000));
+	}
+	bmp180_complete(context);
+	count++;
+	failed |= measurements.temperature != 150 || measurements.pressure != 69964;
+    }
+
+    printf("%-26s %4u %6u samples/s\n", name, samples, count);
+    if (failed) {
+	fprintf(stderr, "%s: expected 150 and 69964\n", name);
+    }
+    bmp180_set_streaming(context, 0, 1000);
+    return failed;
+}
+
+/*
+ * Measures back to back for a second of simulated time, charging the given
+ * time for compensating and sending each sample, and prints the rate. With
+ * overlap, the next sample is started before the work as in src/main.c, so
+ * that its temperature converts meanwhile.
+ */
+static int pipeline(const char *name, struct bmp180_context *context, uint8_t overlap, double work_us)
+{
+    struct bmp180_measurements measurements;
+    struct bmp180_measurements sample;
+    double start = sim_time_us();
+    unsigned count = 0;
+    uint8_t started = 0;
+    int failed = 0;
+
+    while (sim_time_us() - start < 1000000) {
+	if (!started) {
+	    bmp180_start(context, &measurements);
+	}
+	started = 0;
+	while (bmp180_poll(context) == BMP180_BUSY) {
+	    sim_idle_us(1000 - fmod(sim_time_us(), 1000));
+	}
+
+	sample = measurements;
+	if (overlap) {
+	    bmp180_start(context, &measurements);
+	    bmp180_poll(context);
+	    started = 1;
+	}
+	bmp180_compensate(context, &sample);
+	sim_idle_us(work_us);
+	count++;
+	failed |= sample.temperature != 150 || sample.pressure != 69964;
+    }
+
+    /*
+     * Finish the sample left converting
+     */
+    while (started && bmp180_poll(context) == BMP180_BUSY) {
+	sim_idle_us(1000 - fmod(sim_time_us(), 1000));
+    }
+
+    printf("%-26s %4.0f %6u samples/s\n", name, work_us / 1000, count);
+    if (failed) {
+	fprintf(stderr, "%s: expected 150 and 69964\n", name);
+    }
+    return failed;
+}
+
+#ifdef I2C_LANES
+
+/*
+ * Returns the BMP180 model on a lane
+ */
+static struct sim_bmp180 *lane_bmp180(uint8_t lane)
+{
+    for (uint8_t pin = 0; pin < 8; pin++) {
+	if ((I2C_LANES) & (1 << pin) && lane-- == 0) {
+	    return sim_bmp180_pin(pin);
+	}
+    }
+    return NULL;
+}
+
+/*
+ * Runs one set of measurements on every lane at once, each sensor with its
+ * own raw results, and checks the lanes that completed them against the
+ * compensation of each lane's raw results alone
+ */
+static int run_lanes(const char *name, struct bmp180_lanes *lanes, uint8_t expected)
+{
+    struct bmp180_measurements measurements[I2C_LANE_COUNT];
+    double start = sim_time_us();
+    int failed = 0;
+
+    for (uint8_t lane = 0; lane < I2C_LANE_COUNT; lane++) {
+	lane_bmp180(lane)->ut = 27898 + 500 * lane;
+	lane_bmp180(lane)->up = 23843 + 1000 * lane;
+    }
+
+    sim_take_stats();
+    bmp180_lanes_start(lanes, measurements);
+    while (bmp180_lanes_poll(lanes) == BMP180_BUSY) {
+	sim_idle_us(1000 - fmod(sim_time_us(), 1000));
+    }
+    uint8_t completed = bmp180_lanes_complete(lanes);
+
+    struct sim_stats stats = sim_take_stats();
+    printf("%-26s %4u %7lu %6lu %6lu %5lu %9.2f %9.2f  lanes %02x\n", name, lanes->mode,
+	    stats.edges, stats.bytes, stats.transactions, stats.naks,
+	    stats.bus_us / 1000, (sim_time_us() - start) / 1000, completed);
+
+    if (completed != expected) {
+	fprintf(stderr, "%s: expected lanes %02x\n", name, expected);
+	failed = 1;
+    }
+    if (stats.violations) {
+	fprintf(stderr, "%s: %lu periods too short, the first a %s\n", name, stats.violations, stats.violation);
+	failed = 1;
+    }
+
+    for (uint8_t lane = 0; lane < I2C_LANE_COUNT; lane++) {
+	struct bmp180_calibration calibration = lanes->calibration[lane];
+	struct bmp180_measurements alone = {
+	    .ut = lane_bmp180(lane)->ut,
+	    .up = (lane_bmp180(lane)->up << 8) >> (8 - lanes->mode),
+	    .oss = lanes->mode,
+	};
+
+	if (!(completed & (1 << lane))) {
+	    continue;
+	}
+	bmp180_calculate(&calibration, &alone);
+	if (measurements[lane].temperature != alone.temperature || measurements[lane].pressure != alone.pressure) {
+	    fprintf(stderr, "%s: lane %u measured %ld and %ld, expected %ld and %ld\n", name, lane,
+		    (long) measurements[lane].temperature, (long) measurements[lane].pressure,
+		    (long) alone.temperature, (long) alone.pressure);
+	    failed = 1;
+	}
+    }
+
+    for (uint8_t lane = 0; lane < I2C_LANE_COUNT; lane++) {
+	lane_bmp180(lane)->ut = 27898;
+	lane_bmp180(lane)->up = 23843;
+    }
+    return failed;
+}
+
+#endif
+
+int main(void)
+{
+    struct bmp180_context context;
+    struct bmp180_measurements measurements = {0};
+    int failed = 0;
+
+    sim_bmp180_reset();
+
+    printf("%-26s %4s %7s %6s %6s %5s %9s %9s %6s %7s\n", "measurements", "oss",
+	    "edges", "bytes", "trans", "naks", "bus ms", "total ms", "T", "p");
+
+    bmp180_init(&context);
+    failed |= run("cold boot", &context, &measurements, BMP180_READY);
+    failed |= run("calibrated", &context, &measurements, BMP180_READY);
+
+    bmp180_init(&context);
+    failed |= run("warm boot (EEPROM)", &context, &measurements, BMP180_READY);
+
+    /*
+     * A different sensor is calibrated afresh, and something other than a
+     * BMP180 is not measured at all
+     */
+    sim_bmp180()->registers[0xAB]++;
+    bmp180_init(&context);
+    bmp180_start(&context, &measurements);
+    while (bmp180_poll(&context) == BMP180_BUSY) {
+	sim_idle_us(1000);
+    }
+    if (context.calibration.ac1 != 409) {
+	fprintf(stderr, "replaced sensor: the saved calibration data was used\n");
+	failed = 1;
+    }
+    sim_bmp180()->registers[0xAB]--;
+    bmp180_init(&context);
+    failed |= run("replaced sensor", &context, &measurements, BMP180_READY);
+    sim_bmp180()->registers[0xD0] = 0x56;
+    bmp180_init(&context);
+    failed |= run("wrong chip ID", &context, &measurements, BMP180_ERROR);
+    sim_bmp180()->registers[0xD0] = BMP180_CHIP_ID;
+    failed |= run("after the error", &context, &measurements, BMP180_READY);
+
+    for (uint8_t mode = BMP180_ULTRA_LOW_POWER; mode <= BMP180_ULTRA_HIGH_RESOLUTION; mode++) {
+	bmp180_set_mode(&context, mode);
+	failed |= run("fixed conversion time", &context, &measurements, BMP180_READY);
+    }
+
+    /*
+     * A mode out of range measures at the highest one
+     */
+    bmp180_set_mode(&context, BMP180_ULTRA_HIGH_RESOLUTION + 1);
+    failed |= run("mode out of range", &context, &measurements, BMP180_READY);
+    if (measurements.oss != BMP180_ULTRA_HIGH_RESOLUTION) {
+	fprintf(stderr, "mode out of range: measured at oss %u\n", measurements.oss);
+	failed = 1;
+    }
+
+    bmp180_set_eoc_polling(&context, 1);
+    for (uint8_t mode = BMP180_ULTRA_LOW_POWER; mode <= BMP180_ULTRA_HIGH_RESOLUTION; mode++) {
+	bmp180_set_mode(&context, mode);
+	failed |= run("end of conversion polling", &context, &measurements, BMP180_READY);
+    }
+
+    /*
+     * Bus errors: the driver recovers and retries within its budget, and
+     * gives up on the measurements beyond it
+     */
+    bmp180_set_eoc_polling(&context, 0);
+    bmp180_set_mode(&context, BMP180_ULTRA_LOW_POWER);
+    sim_bmp180()->nak_addresses = 1;
+    failed |= run("NAK, retried", &context, &measurements, BMP180_READY);
+    sim_bmp180()->nak_addresses = BMP180_RETRIES + 1;
+    failed |= run("NAKs beyond the retries", &context, &measurements, BMP180_ERROR);
+    sim_bmp180()->nak_addresses = 0;
+    failed |= run("after the error", &context, &measurements, BMP180_READY);
+    sim_bmp180_hold_sda();
+    failed |= run("SDA held LOW", &context, &measurements, BMP180_READY);
+
+#ifdef I2C_LANES
+    struct bmp180_lanes lanes;
+
+    printf("\n%-26s\n", "lanes");
+    bmp180_lanes_init(&lanes);
+    for (uint8_t mode = BMP180_ULTRA_LOW_POWER; mode <= BMP180_ULTRA_HIGH_RESOLUTION; mode++) {
+	bmp180_lanes_set_mode(&lanes, mode);
+	failed |= run_lanes("every lane", &lanes, I2C_LANES_ALL);
+    }
+
+    /*
+     * A lane that fails is retried with the others, and drops out of the
+     * measurements beyond the retries
+     */
+    bmp180_lanes_set_mode(&lanes, BMP180_ULTRA_LOW_POWER);
+    lane_bmp180(1)->nak_addresses = 1;
+    failed |= run_lanes("NAK on a lane, retried", &lanes, I2C_LANES_ALL);
+    lane_bmp180(1)->nak_addresses = BMP180_RETRIES + 1;
+    failed |= run_lanes("NAKs beyond the retries", &lanes, I2C_LANES_ALL & ~(1 << 1));
+    lane_bmp180(1)->nak_addresses = 0;
+
+    /*
+     * The lane that failed is looked for again as a missing sensor, and
+     * calibrated afresh in case it was replaced, as is a sensor missing from
+     * the start
+     */
+    lane_bmp180(1)->registers[0xAB]++;
+    for (unsigned i = 1; i < BMP180_LANES_IDENTIFY_SAMPLES; i++) {
+	failed |= run_lanes("after the error", &lanes, I2C_LANES_ALL & ~(1 << 1));
+    }
+    failed |= run_lanes("lane looked for again", &lanes, I2C_LANES_ALL);
+    if (lanes.calibration[1].ac1 != 409) {
+	fprintf(stderr, "lane looked for again: the old calibration data was used\n");
+	failed = 1;
+    }
+    lane_bmp180(1)->registers[0xAB]--;
+
+    /*
+     * A sensor stretching SCL for too long fails the read on every lane, as
+     * they share the clock, and the lanes drop out beyond the retries
+     */
+    lane_bmp180(1)->stretch_reads = 1;
+    failed |= run_lanes("SCL stretched, retried", &lanes, I2C_LANES_ALL);
+    lane_bmp180(1)->stretch_reads = BMP180_RETRIES + 1;
+    failed |= run_lanes("SCL stretched beyond", &lanes, 0);
+    lane_bmp180(1)->stretch_reads = 0;
+
+    lane_bmp180(2)->absent = 1;
+    bmp180_lanes_init(&lanes);
+    failed |= run_lanes("missing lane", &lanes, I2C_LANES_ALL & ~(1 << 2));
+    lane_bmp180(2)->absent = 0;
+    for (unsigned i = 1; i < BMP180_LANES_IDENTIFY_SAMPLES; i++) {
+	failed |= run_lanes("lane connected", &lanes, I2C_LANES_ALL & ~(1 << 2));
+    }
+    failed |= run_lanes("lane looked for again", &lanes, I2C_LANES_ALL);
+#endif
+
+    /*
+     * The time the device takes to compensate, format and queue a sample is
+     * not simulated, so these rates are for assumed costs
+     */
+    printf("\n%-26s %4s\n", "pipelining", "work ms");
+    for (unsigned work = 2; work <= 8; work *= 2) {
+	failed |= pipeline("sequential", &context, 0, work * 1000);
+	failed |= pipeline("next sample started", &context, 1, work * 1000);
+    }
+
+    printf("\n%-26s %4s\n", "streaming", "UT reuse");
+    failed |= stream("fixed conversion time", &context, 0);
+    failed |= stream("fixed conversion time", &context, 255);
+    bmp180_set_eoc_polling(&context, 1);
+    failed |= stream("end of conversion polling", &context, 0);
+    failed |= stream("end of conversion polling", &context, 255);
+
+    return failed;
+}
@@ -0,0 +1,294 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "bmp180.h"
+
+/*
+ * Compares the integer compensation of bmp180_calculate() against the
+ * datasheet algorithm in double precision, sweeping UT and UP over their
+ * full ranges for several calibration sets and every oversampling setting.
+ * Over the same sweep, the results must match the datasheet integer
+ * algorithm, worked out in 64 bits, bit for bit. Then it times the
+ * compensation against the original pow() version. The rates are those of
+ * the host, so they only compare one implementation with another.
+ */
+
+/*
+ * Steps of the sweeps, covering the 16 bit UT and the 16 to 19 bit UP
+ */
+#define UT_STEP 16
+#define UP_STEPS 2048
+
+/*
+ * Operating range of the sensor. Outside it the raw values are not ones the
+ * sensor returns, so the results are counted but not compared.
+ */
+#define TEMPERATURE_MIN -400
+#define TEMPERATURE_MAX 850
+#define PRESSURE_MIN 30000
+#define PRESSURE_MAX 110000
+
+/*
+ * Errors allowed against the reference, in 0.1 C and Pa. The datasheet
+ * algorithm truncates at every step, the square of the pressure most of all,
+ * so it is up to about 24 Pa out near 110 kPa but under 2 Pa on average.
+ */
+#define T_MAX_ERROR 1.5
+#define P_MAX_ERROR 25.0
+#define P_MEAN_ERROR 2.5
+
+/*
+ * The datasheet example, and sets spread around it so that the terms of the
+ * compensation take other signs and magnitudes
+ */
+static const struct bmp180_calibration calibrations[] = {
+    { 408, -72, -14383, 32741, 32757, 23153, 6190, 4, -32768, -8711, 2868 },
+    { 8240, -1196, -14709, 32912, 24959, 16487, 6515, 48, -32768, -11786, 2845 },
+    { 6835, -1034, -14442, 33526, 24928, 19150, 6515, 38, -32768, -11786, 2431 },
+    { 7540, -1111, -14521, 34007, 25162, 18240, 5498, 56, -32768, -11075, 2432 },
+};
+
+#define CALIBRATIONS (sizeof(calibrations) / sizeof(calibrations[0]))
+
+/*
+ * Calculates B5 as the datasheet does, without truncating
+ */
+static double reference_b5(const struct bmp180_calibration *c, double ut)
+{
+    double x1 = (ut - c->ac6) * c->ac5 / 32768.0;
+    return x1 + c->mc * 2048.0 / (x1 + c->md);
+}
+
+/*
+ * Calculates the pressure from B5 and UP as the datasheet does, without
+ * truncating
+ */
+static double reference_pressure(const struct bmp180_calibration *c, double b5, double up, int oss)
+{
+    double b6 = b5 - 4000;
+    double x3 = c->b2 * (b6 * b6 / 4096) / 2048 + c->ac2 * b6 / 2048;
+    double b3 = (c->ac1 * 4 + x3) * (1 << oss) / 4;
+    x3 = (c->ac3 * b6 / 8192 + c->b1 * (b6 * b6 / 4096) / 65536) / 4;
+    double b4 = c->ac4 * (x3 + 32768) / 32768;
+    double p = (up - b3) * (50000 >> oss) * 2 / b4;
+    return p + ((p / 256) * (p / 256) * 3038 / 65536 - 7357 * p / 65536 + 3791) / 16;
+}
+
+/*
+ * Divides by 2 to the power of n, rounding down as the datasheet's divisions
+ * by powers of two do, with a division rather than a shift so that it owes
+ * nothing to bmp180_calculate()
+ */
+static int64_t floor_div(int64_t value, int n)
+{
+    int64_t divisor = (int64_t) 1 << n;
+    int64_t quotient = value / divisor;
+
+    return quotient * divisor > value ? quotient - 1 : quotient;
+}
+
+/*
+ * The datasheet integer algorithm, written afresh from its formulas with
+ * every term in 64 bits, so that no product is cut short. Only the other
+ * divisions truncate toward zero, and B7 takes the datasheet's two ways of
+ * dividing by B4.
+ *
+ * bmp180_calculate() is built here with a 32 bit int, where the AVR's is 16
+ * bits, so a product of two 16 bit operands that fits here may overflow on
+ * the device and still match. None is caught by this check: each product in
+ * bmp180_calculate() must keep an int32_t or uint32_t operand.
+ */
+static void datasheet_calculate(const struct bmp180_calibration *c, struct bmp180_measurements *m)
+{
+    int64_t x1 = floor_div(((int64_t) m->ut - c->ac6) * c->ac5, 15);
+    int64_t x2 = (int64_t) c->mc * 2048 / (x1 + c->md);
+    int64_t b5 = x1 + x2;
+    m->temperature = floor_div(b5 + 8, 4);
+
+    int64_t b6 = b5 - 4000;
+    x1 = floor_div((int64_t) c->b2 * floor_div(b6 * b6, 12), 11);
+    x2 = floor_div((int64_t) c->ac2 * b6, 11);
+    int64_t x3 = x1 + x2;
+    int64_t b3 = floor_div(((int64_t) c->ac1 * 4 + x3) * (1 << m->oss) + 2, 2);
+    x1 = floor_div((int64_t) c->ac3 * b6, 13);
+    x2 = floor_div((int64_t) c->b1 * floor_div(b6 * b6, 12), 16);
+    x3 = floor_div(x1 + x2 + 2, 2);
+    int64_t b4 = floor_div((int64_t) c->ac4 * (x3 + 32768), 15);
+    int64_t b7 = ((int64_t) m->up - b3) * (50000 >> m->oss);
+    int64_t p = b7 < 0x80000000 ? b7 * 2 / b4 : b7 / b4 * 2;
+    x1 = floor_div(p, 8) * floor_div(p, 8);
+    x1 = floor_div(x1 * 3038, 16);
+    x2 = floor_div(-7357 * p, 16);
+    m->pressure = p + floor_div(x1 + x2 + 3791, 4);
+}
+
+/*
+ * The original compensation, dividing by pow() in double precision, so that
+ * its divisions truncate toward zero where the shifts round down. Only timed.
+ */
+static __attribute__((noinline)) void pow_calculate(const struct bmp180_calibration *c, struct bmp180_measurements *m)
+{
+    int32_t x1 = (m->ut - c->ac6) * c->ac5 / pow(2, 15);
+    int32_t x2 = c->mc * pow(2, 11) / (x1 + c->md);
+    int32_t b5 = x1 + x2;
+    m->temperature = (b5 + 8) / pow(2, 4);
+
+    int32_t b6 = b5 - 4000;
+    x1 = (c->b2 * (b6 * b6 / pow(2, 12))) / pow(2, 11);
+    x2 = c->ac2 * b6 / pow(2, 11);
+    int32_t x3 = x1 + x2;
+    int32_t b3 = (((c->ac1 * 4 + x3) << m->oss) + 2) / 4;
+    x1 = c->ac3 * b6 / pow(2, 13);
+    x2 = (c->b1 * (b6 * b6 / pow(2, 12))) / pow(2, 16);
+    x3 = (x1 + x2 + 2) / pow(2, 2);
+    uint32_t b4 = c->ac4 * (uint32_t) (x3 + 32768) / pow(2, 15);
+    uint32_t b7 = ((uint32_t) m->up - b3) * (50000 >> m->oss);
+    if (b7 < 0x80000000) {
+	m->pressure = (b7 * 2) / b4;
+    } else {
+	m->pressure = (b7 / b4) * 2;
+    }
+    x1 = (m->pressure / pow(2, 8)) * (m->pressure / pow(2, 8));
+    x1 = (x1 * 3038) / pow(2, 16);
+    x2 = (-7357 * m->pressure) / pow(2, 16);
+    m->pressure += (x1 + x2 + 3791) / pow(2, 4);
+}
+
+/*
+ * Returns the monotonic time in seconds
+ */
+static double seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * Calls bmp180_calculate(), which leaves the calibration data alone
+ */
+static void device_calculate(const struct bmp180_calibration *c, struct bmp180_measurements *m)
+{
+    bmp180_calculate((struct bmp180_calibration *) c, m);
+}
+
+/*
+ * Times a compensation over a spread of typical values, and prints its rate
+ */
+static void time_calculate(const char *name, void (*calculate)(const struct bmp180_calibration *, struct bmp180_measurements *))
+{
+    const long samples = 20000000;
+    struct bmp180_measurements measurements = { .oss = 3 };
+    volatile int32_t sink = 0;
+    double start = seconds();
+
+    for (long i = 0; i < samples; i++) {
+	measurements.ut = 27000 + (i & 2047);
+	measurements.up = 190000 + (i & 16383);
+	calculate(&calibrations[0], &measurements);
+	sink += measurements.pressure;
+    }
+    printf("%-26s %.0f samples/s\n", name, samples / (seconds() - start));
+}
+
+int main(void)
+{
+    int failed = 0;
+    struct bmp180_calibration calibration = calibrations[0];
+    struct bmp180_measurements measurements = { .ut = 27898, .up = 23843, .oss = 0 };
+
+    bmp180_calculate(&calibration, &measurements);
+    printf("datasheet example: %ld (0.1 C) %ld (Pa)\n", (long) measurements.temperature, (long) measurements.pressure);
+    failed |= measurements.temperature != 150 || measurements.pressure != 69964;
+
+    printf("%3s %3s %10s %10s %6s %6s %10s %6s %6s %9s\n", "set", "oss", "compared", "skipped",
+	    "T max", "T mean", "p at max", "p max", "p mean", "not exact");
+
+    for (unsigned set = 0; set < CALIBRATIONS; set++) {
+	const struct bmp180_calibration *c = &calibrations[set];
+
+	for (int oss = 0; oss <= 3; oss++) {
+	    long compared = 0, skipped = 0, inexact = 0;
+	    double t_worst = 0, t_total = 0, p_worst = 0, p_total = 0;
+	    long p_worst_at = 0;
+	    long up_max = 1L << (16 + oss);
+
+	    for (long ut = 0; ut < 65536; ut += UT_STEP) {
+		double b5 = reference_b5(c, ut);
+		double temperature = b5 / 16;
+
+		/*
+		 * The temperature depends on UT alone, and outside the
+		 * operating range the integer divisions may be by zero
+		 */
+		if (temperature < TEMPERATURE_MIN || temperature > TEMPERATURE_MAX) {
+		    skipped += UP_STEPS;
+		    continue;
+		}
+
+		for (long up = 0; up < up_max; up += up_max / UP_STEPS) {
+		    double pressure = reference_pressure(c, b5, up, oss);
+		    if (pressure < PRESSURE_MIN || pressure > PRESSURE_MAX) {
+			skipped++;
+			continue;
+		    }
+
+		    calibration = *c;
+		    measurements.ut = ut;
+		    measurements.up = up;
+		    measurements.oss = oss;
+		    bmp180_calculate(&calibration, &measurements);
+
+		    struct bmp180_measurements datasheet = { .ut = ut, .up = up, .oss = oss };
+		    datasheet_calculate(c, &datasheet);
+		    if (datasheet.temperature != measurements.temperature || datasheet.pressure != measurements.pressure) {
+			inexact++;
+		    }
+
+		    double t_error = fabs(measurements.temperature - temperature);
+		    double p_error = fabs(measurements.pressure - pressure);
+		    t_total += t_error;
+		    p_total += p_error;
+		    if (t_error > t_worst) {
+			t_worst = t_error;
+		    }
+		    if (p_error > p_worst) {
+			p_worst = p_error;
+			p_worst_at = measurements.pressure;
+		    }
+		    compared++;
+		}
+	    }
+
+	    printf("%3u %3d %10ld %10ld %6.2f %6.2f %10ld %6.2f %6.2f %9ld\n", set, oss, compared, skipped,
+		    t_worst, t_total / compared, p_worst_at, p_worst, p_total / compared, inexact);
+	    failed |= compared == 0 || inexact || t_worst > T_MAX_ERROR || p_worst > P_MAX_ERROR || p_total / compared > P_MEAN_ERROR;
+	}
+    }
+
+    /*
+     * Time the original compensation, the full compensation, and the
+     * pressure alone as when B5 is reused
+     */
+    time_calculate("pow() (original)", pow_calculate);
+    time_calculate("bmp180_calculate", device_calculate);
+
+    const long samples = 20000000;
+    volatile int32_t sink = 0;
+    int32_t b5 = bmp180_calculate_b5(&calibrations[0], 27898);
+    double start = seconds();
+
+    measurements.oss = 3;
+    for (long i = 0; i < samples; i++) {
+	measurements.up = 190000 + (i & 16383);
+	bmp180_calculate_pressure(&calibrations[0], b5, &measurements);
+	sink += measurements.pressure;
+    }
+    printf("%-26s %.0f samples/s\n", "bmp180_calculate_pressure", samples / (seconds() - start));
+
+    return failed;
+}
@@ -0,0 +1,37 @@
+#include <stdio.h>
+
+#include "telemetry_decode.h"
+
+/*
+ * Decodes binary telemetry frames from a file, or standard input, and prints
+ * one record per line: sequence, temperature (°C) and pressure (Pa)
+ */
+int main(int argc, char **argv)
+{
+    FILE *input = stdin;
+    struct telemetry_decoder decoder;
+    struct telemetry_record record;
+    int c;
+
+    if (argc > 2) {
+	fprintf(stderr, "usage: %s [file]\n", argv[0]);
+	return 2;
+    }
+    if (argc == 2 && !(input = fopen(argv[1], "rb"))) {
+	perror(argv[1]);
+	return 1;
+    }
+
+    telemetry_decoder_init(&decoder);
+    while ((c = fgetc(input)) != EOF) {
+	if (!telemetry_decoder_feed(&decoder, (uint8_t) c, &record)) {
+	    continue;
+	}
+
+	printf("%u\t%.1f\t%ld\n", record.sequence, record.temperature / 10.0, (long) record.pressure);
+	fflush(stdout);
+    }
+
+    fprintf(stderr, "%lu frames, %lu invalid, %lu lost, %lu unresolved\n", decoder.frames, decoder.errors, decoder.lost, decoder.unresolved);
+    return 0;
+}
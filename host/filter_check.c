@@ -0,0 +1,57 @@
+#include <stdio.h>
+
+#include "filter.h"
+
+/*
+ * Runs both filters at the largest shift, where the sample count and the sums
+ * are closest to their limits, with samples at the top of the pressure range
+ */
+
+#define TEMPERATURE 850
+#define PRESSURE 110000
+
+int main(void)
+{
+    struct filter filter;
+    struct bmp180_measurements measurements;
+    unsigned long samples = 1UL << FILTER_SHIFT_MAX;
+    unsigned long outputs = 0;
+    int failed = 0;
+
+    filter_init(&filter, FILTER_AVERAGE, FILTER_SHIFT_MAX);
+    for (unsigned long i = 0; i < 3 * samples; i++) {
+	measurements.temperature = TEMPERATURE + (i & 1);
+	measurements.pressure = PRESSURE + (i & 1);
+	if (!filter_update(&filter, &measurements)) {
+	    continue;
+	}
+
+	outputs++;
+	if ((i + 1) % samples || measurements.temperature != TEMPERATURE + 1 || measurements.pressure != PRESSURE + 1) {
+	    fprintf(stderr, "average: sample %lu gave %ld %ld\n", i, (long) measurements.temperature, (long) measurements.pressure);
+	    failed = 1;
+	}
+    }
+    printf("average of %lu: %lu outputs\n", samples, outputs);
+    failed |= outputs != 3;
+
+    /*
+     * Step from the bottom of the range to the top, and check that the
+     * output settles on the top rather than overflowing
+     */
+    filter_init(&filter, FILTER_IIR, FILTER_SHIFT_MAX);
+    for (unsigned long i = 0; i < 64 * samples; i++) {
+	measurements.temperature = i ? TEMPERATURE : -400;
+	measurements.pressure = i ? PRESSURE : 30000;
+	filter_update(&filter, &measurements);
+	if (measurements.pressure < 30000 || measurements.pressure > PRESSURE) {
+	    fprintf(stderr, "iir: sample %lu gave %ld\n", i, (long) measurements.pressure);
+	    failed = 1;
+	    break;
+	}
+    }
+    printf("iir at 1/%lu: settled on %ld %ld\n", samples, (long) measurements.temperature, (long) measurements.pressure);
+    failed |= measurements.temperature != TEMPERATURE || measurements.pressure != PRESSURE;
+
+    return failed;
+}
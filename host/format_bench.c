@@ -0,0 +1,135 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "format.h"
+#include "usi.h"
+
+/*
+ * Compares the output line of src/main.c sent with src/format.c against the
+ * sprintf() line it replaced: checks that the line comes out the same, and
+ * prints the RAM the sprintf() line needed and the time each takes on the
+ * host. The host times say nothing of the AVR, where there is no hardware
+ * division and avr-libc's vfprintf is a different implementation.
+ */
+
+/*
+ * The format string and buffer of the sprintf() line, which avr-gcc keeps in
+ * RAM and on the stack respectively
+ */
+#define SPRINTF_FORMAT u8"Temperature: %ld (0.1 °C)\tPressure: %ld (Pa)\n"
+#define SPRINTF_BUFFER 100
+
+#define LINES 10000000
+
+static char sent[SPRINTF_BUFFER];
+static unsigned length;
+
+/*
+ * Collects what the formatter sends instead of queueing it for the UART
+ */
+void usi_send_byte(char byte)
+{
+    sent[length++] = byte;
+}
+
+void usi_send_data_P(const char *str)
+{
+    while (*str) {
+	usi_send_byte(*str++);
+    }
+}
+
+/*
+ * Sends the line as src/main.c does
+ */
+static void format_line(int32_t temperature, int32_t pressure)
+{
+    length = 0;
+    usi_send_data_P("Temperature: ");
+    format_int32(temperature);
+    usi_send_data_P(u8" (0.1 °C)\tPressure: ");
+    format_int32(pressure);
+    usi_send_data_P(" (Pa)\n");
+    sent[length] = '\0';
+}
+
+/*
+ * Returns the monotonic time in seconds
+ */
+static double seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+    char expected[SPRINTF_BUFFER];
+    int failed = 0;
+
+    /*
+     * Every temperature in the operating range, and pressures to the
+     * extremes of 32 bits
+     */
+    for (int32_t t = -400; t <= 850; t++) {
+	int32_t p = 30000 + (t + 400) * 64;
+	format_line(t, p);
+	snprintf(expected, sizeof(expected), SPRINTF_FORMAT, (long) t, (long) p);
+	if (strcmp(sent, expected)) {
+	    fprintf(stderr, "expected %s got %s", expected, sent);
+	    failed = 1;
+	}
+    }
+
+    /*
+     * The altitude is sent in fixed point
+     */
+    for (int32_t a = -5000; a <= 5000; a++) {
+	length = 0;
+	format_fixed(a, 1);
+	sent[length] = '\0';
+	snprintf(expected, sizeof(expected), "%s%ld.%ld", a < 0 ? "-" : "", (long) (a < 0 ? -a : a) / 10, (long) (a < 0 ? -a : a) % 10);
+	if (strcmp(sent, expected)) {
+	    fprintf(stderr, "expected %s got %s\n", expected, sent);
+	    failed = 1;
+	}
+    }
+
+    static const int32_t extremes[] = { 0, 1, -1, 9, 10, 99999, 2147483647L, -2147483647L - 1 };
+    for (unsigned i = 0; i < sizeof(extremes) / sizeof(extremes[0]); i++) {
+	length = 0;
+	format_int32(extremes[i]);
+	sent[length] = '\0';
+	snprintf(expected, sizeof(expected), "%ld", (long) extremes[i]);
+	if (strcmp(sent, expected)) {
+	    fprintf(stderr, "expected %s got %s\n", expected, sent);
+	    failed = 1;
+	}
+    }
+    printf("output: %s\n", failed ? "differs" : "same line as sprintf");
+
+    printf("sprintf RAM: %zu bytes of format string, %d bytes of buffer\n",
+	    sizeof(SPRINTF_FORMAT), SPRINTF_BUFFER);
+
+    volatile unsigned sink = 0;
+    double start = seconds();
+    for (long i = 0; i < LINES; i++) {
+	format_line(150 + (i & 511), 69964 + (i & 4095));
+	sink += length;
+    }
+    double formatter = (seconds() - start) / LINES * 1e9;
+
+    start = seconds();
+    for (long i = 0; i < LINES; i++) {
+	sink += snprintf(sent, sizeof(sent), SPRINTF_FORMAT, 150L + (i & 511), 69964L + (i & 4095));
+    }
+    double sprintf_ns = (seconds() - start) / LINES * 1e9;
+
+    printf("host time per line: %.1f ns formatter, %.1f ns sprintf\n", formatter, sprintf_ns);
+    return failed;
+}
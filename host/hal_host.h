@@ -0,0 +1,68 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef HAL_HOST_H
+#define HAL_HOST_H
+
+/*
+ * Host implementation of src/hal.h, backed by the simulated bus in sim.h
+ */
+
+#include "sim.h"
+
+#define HAL_SCL_LOW()     sim_scl(1)
+#define HAL_SCL_RELEASE() sim_scl(0)
+#define HAL_SDA_LOW()     sim_sda(1)
+#define HAL_SDA_RELEASE() sim_sda(0)
+#define HAL_SDA_READ()    sim_sda_read()
+#define HAL_SCL_READ()    sim_scl_read()
+
+#define HAL_SDA_LANES(pins, low) sim_sda_lanes(pins, low)
+#define HAL_SDA_LANES_READ()     sim_sda_lanes_read()
+
+#define HAL_DELAY_CYCLES(cycles) sim_delay_us((cycles) * 1e6 / F_CPU)
+
+/*
+ * The code between the delays of src/i2c.c takes time on the device, so
+ * charge its estimates where src/i2c.c marks it
+ */
+#define HAL_CODE_CYCLES(cycles) sim_delay_us((cycles) * 1e6 / F_CPU)
+
+/*
+ * EEPROM variables are ordinary variables, so they keep their contents for
+ * as long as the process runs
+ */
+#define EEMEM
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+    memcpy(dst, src, n);
+}
+
+static inline void eeprom_update_block(const void *src, void *dst, size_t n)
+{
+    memcpy(dst, src, n);
+}
+
+/*
+ * Program memory is ordinary memory
+ */
+#define PROGMEM
+#define memcpy_P memcpy
+#define pgm_read_byte(address) (*(const uint8_t *) (address))
+#define pgm_read_dword(address) (*(const uint32_t *) (address))
+
+/*
+ * As avr-libc's _crc8_ccitt_update()
+ */
+static inline uint8_t _crc8_ccitt_update(uint8_t crc, uint8_t data)
+{
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; i++) {
+	crc = (crc & 0x80) ? (uint8_t) (crc << 1) ^ 0x07 : (uint8_t) (crc << 1);
+    }
+    return crc;
+}
+
+#endif
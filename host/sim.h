@@ -0,0 +1,142 @@
+#include <stdint.h>
+
+#ifndef SIM_H
+#define SIM_H
+
+/*
+ * The simulated port has a BMP180 on the SDA pin of src/i2c.c, and one on
+ * every pin of the lanes when I2C_LANES is set
+ */
+#define SIM_SDA_PIN 3
+
+#ifdef I2C_LANES
+#define SIM_SDA_PINS ((1 << SIM_SDA_PIN) | (I2C_LANES))
+#else
+#define SIM_SDA_PINS (1 << SIM_SDA_PIN)
+#endif
+
+/*
+ * Represents the activity counted on the simulated bus, and the periods that
+ * fell short of the minimum of the mode, the first of which is named
+ */
+struct sim_stats {
+    unsigned long edges;
+    unsigned long bytes;
+    unsigned long transactions;
+    unsigned long naks;
+    double bus_us;
+    unsigned long violations;
+    const char *violation;
+};
+
+/*
+ * Drives SCL or SDA LOW (non-zero) or releases it (zero) from the master
+ */
+void sim_scl(uint8_t low);
+void sim_sda(uint8_t low);
+
+/*
+ * Returns non-zero if SDA or SCL is HIGH
+ */
+uint8_t sim_sda_read(void);
+uint8_t sim_scl_read(void);
+
+/*
+ * Drives LOW the SDA lines of the given pins that are set in low, and
+ * releases the others, from the master
+ */
+void sim_sda_lanes(uint8_t pins, uint8_t low);
+
+/*
+ * Returns the SDA pins that are HIGH
+ */
+uint8_t sim_sda_lanes_read(void);
+
+/*
+ * Advances the simulated time while the master holds the bus
+ */
+void sim_delay_us(double us);
+
+/*
+ * Advances the simulated time while the master does not use the bus
+ */
+void sim_idle_us(double us);
+
+/*
+ * Returns the simulated time in microseconds
+ */
+double sim_time_us(void);
+
+/*
+ * Counts a byte transferred, and whether it was acknowledged
+ */
+void sim_count_byte(uint8_t acknowledged);
+
+/*
+ * Returns and clears the activity counted since the last call
+ */
+struct sim_stats sim_take_stats(void);
+
+/*
+ * Represents the BMP180 model. The calibration data and raw results default
+ * to the example values of the datasheet. The next nak_addresses addresses
+ * are not acknowledged, to inject bus errors, and none are while absent. The
+ * next stretch_reads bytes read hold SCL LOW after their first bit for twice
+ * as long as the master polls it, to inject clock stretching errors.
+ */
+struct sim_bmp180 {
+    uint8_t registers[256];
+    uint16_t ut;
+    uint32_t up;
+    double conversion_end_us;
+    uint8_t pending;
+    uint8_t nak_addresses;
+    uint8_t stretch_reads;
+    uint8_t absent;
+};
+
+/*
+ * Resets the BMP180 models
+ */
+void sim_bmp180_reset(void);
+
+/*
+ * Returns the BMP180 model on SDA, to change its calibration data or raw
+ * results
+ */
+struct sim_bmp180 *sim_bmp180(void);
+
+/*
+ * Returns the BMP180 model on the given SDA pin
+ */
+struct sim_bmp180 *sim_bmp180_pin(uint8_t pin);
+
+/*
+ * Leaves the BMP180 model in the middle of a read, holding SDA LOW, as if the
+ * master had been reset during a transfer
+ */
+void sim_bmp180_hold_sda(void);
+
+/*
+ * Called by the bus on every change of the lines, with the levels of the SDA
+ * pins
+ */
+void sim_bmp180_bus(uint8_t scl, uint8_t sda, uint8_t old_scl, uint8_t old_sda);
+
+/*
+ * Returns the SDA pins the BMP180 models are pulling LOW
+ */
+uint8_t sim_bmp180_sda_low(void);
+
+/*
+ * Returns non-zero if a BMP180 model is holding SCL LOW
+ */
+uint8_t sim_bmp180_scl_low(void);
+
+/*
+ * Called by the bus every time the master polls SCL while a BMP180 model
+ * holds it LOW, which lets it go after a number of polls
+ */
+void sim_bmp180_scl_poll(void);
+
+#endif
@@ -0,0 +1,306 @@
+#include <string.h>
+
+#include "i2c.h"
+#include "sim.h"
+
+#define ADDRESS 0x77
+#define CONTROL 0xF4
+#define SCO     (1 << 5)
+
+/*
+ * Conversion times in microseconds: temperature, and pressure for each
+ * oversampling setting. They are the typical times of the datasheet, so the
+ * conversions end before the maximum times the driver waits by default.
+ */
+#define UT_CONVERSION_US 3000
+static const double up_conversion_us[] = { 3000, 5000, 9000, 17000 };
+
+/*
+ * Represents the state of the slave on the bus
+ */
+enum slave_state { S_IDLE, S_ADDRESS, S_WRITE, S_READ, S_IGNORE };
+
+/*
+ * Represents a BMP180 on one SDA pin
+ */
+struct slave {
+    struct sim_bmp180 model;
+    enum slave_state state;
+    uint8_t shift;
+    uint8_t bit;
+    uint8_t pointer;
+    uint8_t pointer_set;
+    uint8_t reading;
+    uint8_t master_ack;
+    uint8_t sda_low;
+    unsigned scl_polls;
+};
+
+static struct slave slaves[8];
+
+static void write_word(struct sim_bmp180 *model, uint8_t reg, uint16_t value)
+{
+    model->registers[reg] = value >> 8;
+    model->registers[reg + 1] = value;
+}
+
+void sim_bmp180_reset(void)
+{
+    for (uint8_t pin = 0; pin < 8; pin++) {
+	struct slave *slave = &slaves[pin];
+	struct sim_bmp180 *model = &slave->model;
+
+	memset(slave, 0, sizeof(*slave));
+	write_word(model, 0xAA, 408);
+	write_word(model, 0xAC, -72);
+	write_word(model, 0xAE, -14383);
+	write_word(model, 0xB0, 32741);
+	write_word(model, 0xB2, 32757);
+	write_word(model, 0xB4, 23153);
+	write_word(model, 0xB6, 6190);
+	write_word(model, 0xB8, 4);
+	write_word(model, 0xBA, -32768);
+	write_word(model, 0xBC, -8711);
+	write_word(model, 0xBE, 2868);
+	model->registers[0xD0] = 0x55;
+	model->ut = 27898;
+	model->up = 23843;
+	model->absent = !(SIM_SDA_PINS & (1 << pin));
+	slave->state = S_IDLE;
+    }
+}
+
+struct sim_bmp180 *sim_bmp180(void)
+{
+    return &slaves[SIM_SDA_PIN].model;
+}
+
+struct sim_bmp180 *sim_bmp180_pin(uint8_t pin)
+{
+    return &slaves[pin].model;
+}
+
+/*
+ * Finishes the conversion in progress once its time has passed
+ */
+static void update_conversion(struct sim_bmp180 *model)
+{
+    if (!(model->registers[CONTROL] & SCO) || sim_time_us() < model->conversion_end_us) {
+	return;
+    }
+
+    model->registers[CONTROL] &= ~SCO;
+    if (model->pending == 0x2E) {
+	write_word(model, 0xF6, model->ut);
+	model->registers[0xF8] = 0;
+    } else {
+	/*
+	 * UP is given at the lowest oversampling setting, and the higher
+	 * settings add resolution bits to it
+	 */
+	uint32_t raw = model->up << 8;
+	model->registers[0xF6] = raw >> 16;
+	model->registers[0xF7] = raw >> 8;
+	model->registers[0xF8] = raw;
+    }
+}
+
+/*
+ * Writes a register, starting a conversion when the control register is
+ * written with a measurement command
+ */
+static void write_register(struct sim_bmp180 *model, uint8_t reg, uint8_t value)
+{
+    if (reg != CONTROL) {
+	return;
+    }
+
+    if (value == 0x2E) {
+	model->conversion_end_us = sim_time_us() + UT_CONVERSION_US;
+    } else if ((value & 0x3F) == 0x34) {
+	model->conversion_end_us = sim_time_us() + up_conversion_us[value >> 6];
+    } else {
+	return;
+    }
+
+    model->pending = value;
+    model->registers[CONTROL] = value | SCO;
+}
+
+/*
+ * Handles a complete byte received from the master. Returns non-zero to
+ * acknowledge it.
+ */
+static uint8_t receive(struct slave *slave, uint8_t byte)
+{
+    struct sim_bmp180 *model = &slave->model;
+
+    if (slave->state == S_ADDRESS) {
+	if ((byte >> 1) != ADDRESS || model->absent) {
+	    return 0;
+	}
+	if (model->nak_addresses) {
+	    model->nak_addresses--;
+	    return 0;
+	}
+	slave->reading = byte & 0x01;
+	slave->pointer_set = 0;
+	return 1;
+    }
+
+    if (!slave->pointer_set) {
+	slave->pointer = byte;
+	slave->pointer_set = 1;
+    } else {
+	write_register(model, slave->pointer++, byte);
+    }
+    return 1;
+}
+
+static void drive_bit(struct slave *slave)
+{
+    slave->sda_low = !(slave->model.registers[slave->pointer] & (0x80 >> slave->bit));
+}
+
+void sim_bmp180_hold_sda(void)
+{
+    struct slave *slave = &slaves[SIM_SDA_PIN];
+
+    /*
+     * Register 0x00 reads as zeros, so every bit holds SDA LOW
+     */
+    slave->state = S_READ;
+    slave->pointer = 0x00;
+    slave->bit = 0;
+    drive_bit(slave);
+}
+
+/*
+ * Lets one slave react to a change of SCL or of its SDA pin
+ */
+static void slave_bus(struct slave *slave, uint8_t scl, uint8_t sda, uint8_t old_scl, uint8_t old_sda)
+{
+    update_conversion(&slave->model);
+
+    /*
+     * SDA changing while SCL is HIGH is a START or a STOP
+     */
+    if (scl && old_scl) {
+	if (!sda && old_sda) {
+	    slave->state = S_ADDRESS;
+	    slave->bit = 0;
+	    slave->shift = 0;
+	    slave->sda_low = 0;
+	} else if (sda && !old_sda) {
+	    slave->state = S_IDLE;
+	    slave->sda_low = 0;
+	}
+	return;
+    }
+
+    if (slave->state == S_IDLE || slave->state == S_IGNORE) {
+	return;
+    }
+
+    if (scl && !old_scl) {
+	/*
+	 * Rising edge: the receiver samples SDA
+	 */
+	if (slave->state == S_READ) {
+	    if (slave->bit < 8) {
+		slave->bit++;
+	    } else if (slave->bit == 8) {
+		slave->master_ack = !sda;
+		sim_count_byte(1);
+		slave->bit = 9;
+	    }
+	} else if (slave->bit < 8) {
+	    slave->shift = slave->shift << 1 | sda;
+	    slave->bit++;
+	}
+	return;
+    }
+
+    if (!scl && old_scl) {
+	/*
+	 * Falling edge: the transmitter changes SDA
+	 */
+	if (slave->state == S_READ) {
+	    if (slave->bit < 8) {
+		drive_bit(slave);
+		if (slave->bit == 1 && slave->model.stretch_reads) {
+		    slave->model.stretch_reads--;
+		    slave->scl_polls = 2 * (I2C_STRETCH_LIMIT + 1);
+		}
+	    } else if (slave->bit == 8) {
+		slave->sda_low = 0;
+	    } else if (slave->master_ack) {
+		slave->pointer++;
+		slave->bit = 0;
+		drive_bit(slave);
+	    } else {
+		slave->state = S_IGNORE;
+		slave->sda_low = 0;
+	    }
+	} else if (slave->bit == 8) {
+	    uint8_t ack = receive(slave, slave->shift);
+	    sim_count_byte(ack);
+	    slave->sda_low = ack;
+	    slave->bit = ack ? 9 : 0;
+	    if (!ack) {
+		slave->state = S_IGNORE;
+	    }
+	} else if (slave->bit == 9) {
+	    slave->sda_low = 0;
+	    slave->bit = 0;
+	    slave->shift = 0;
+	    if (slave->state == S_ADDRESS) {
+		slave->state = slave->reading ? S_READ : S_WRITE;
+		if (slave->reading) {
+		    update_conversion(&slave->model);
+		    drive_bit(slave);
+		}
+	    }
+	}
+    }
+}
+
+void sim_bmp180_bus(uint8_t scl, uint8_t sda, uint8_t old_scl, uint8_t old_sda)
+{
+    for (uint8_t pin = 0; pin < 8; pin++) {
+	if (SIM_SDA_PINS & (1 << pin)) {
+	    slave_bus(&slaves[pin], scl, (sda >> pin) & 1, old_scl, (old_sda >> pin) & 1);
+	}
+    }
+}
+
+uint8_t sim_bmp180_sda_low(void)
+{
+    uint8_t pins = 0;
+
+    for (uint8_t pin = 0; pin < 8; pin++) {
+	if (slaves[pin].sda_low) {
+	    pins |= 1 << pin;
+	}
+    }
+    return pins;
+}
+
+uint8_t sim_bmp180_scl_low(void)
+{
+    for (uint8_t pin = 0; pin < 8; pin++) {
+	if (slaves[pin].scl_polls) {
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+void sim_bmp180_scl_poll(void)
+{
+    for (uint8_t pin = 0; pin < 8; pin++) {
+	if (slaves[pin].scl_polls) {
+	    slaves[pin].scl_polls--;
+	}
+    }
+}
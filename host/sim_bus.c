@@ -0,0 +1,216 @@
+#include "i2c.h"
+#include "sim.h"
+#include "timer.h"
+
+/*
+ * Minimum periods of the mode in microseconds. The START hold and STOP setup
+ * times are those of the high period, and the bus free time that of the low
+ * period, in both modes.
+ */
+#define T_LOW    (I2C_T_LOW_NS / 1000.0)
+#define T_HIGH   (I2C_T_HIGH_NS / 1000.0)
+#define T_HD_STA T_HIGH
+#define T_SU_STO T_HIGH
+#define T_BUF    T_LOW
+#if I2C_CLOCK > 100000UL
+#define T_SU_STA 0.6
+#else
+#define T_SU_STA 4.7
+#endif
+
+/*
+ * Rounding in the conversion of the delays to and from cycles
+ */
+#define TOLERANCE_US 1e-6
+
+/*
+ * Simulated open-drain bus: a line is HIGH unless the master or the slave
+ * pulls it LOW
+ */
+static uint8_t master_scl_low = 0;
+static uint8_t master_sda_pins = 0;
+static double now_us = 0;
+static struct sim_stats stats;
+
+/*
+ * When SCL last rose and fell, and when the last START and STOP were
+ */
+static double scl_rise_us = -1e9;
+static double scl_fall_us = -1e9;
+static double start_us = -1e9;
+static double stop_us = -1e9;
+
+static uint8_t scl_level(void)
+{
+    return !master_scl_low && !sim_bmp180_scl_low();
+}
+
+/*
+ * Returns the SDA pins that are HIGH
+ */
+static uint8_t sda_level(void)
+{
+    return ~(master_sda_pins | sim_bmp180_sda_low()) & SIM_SDA_PINS;
+}
+
+/*
+ * Counts a period that lasted less than the given minimum
+ */
+static void check(const char *name, double since_us, double minimum_us)
+{
+    if (now_us - since_us + TOLERANCE_US >= minimum_us) {
+	return;
+    }
+    if (!stats.violations) {
+	stats.violation = name;
+    }
+    stats.violations++;
+}
+
+/*
+ * Checks the timing of a change of the lines against the minimums of the
+ * mode, and notes when it happened
+ */
+static void check_timing(uint8_t scl, uint8_t sda, uint8_t old_scl, uint8_t old_sda)
+{
+    if (scl != old_scl) {
+	if (scl) {
+	    check("SCL low period", scl_fall_us, T_LOW);
+	    scl_rise_us = now_us;
+	} else {
+	    check("SCL high period", scl_rise_us, T_HIGH);
+	    if (start_us > scl_rise_us) {
+		check("START hold time", start_us, T_HD_STA);
+	    }
+	    scl_fall_us = now_us;
+	}
+    } else if (scl && sda != old_sda) {
+	if (old_sda & ~sda) {
+	    check("START setup time", scl_rise_us, T_SU_STA);
+	    check("bus free time", stop_us, T_BUF);
+	    start_us = now_us;
+	} else {
+	    check("STOP setup time", scl_rise_us, T_SU_STO);
+	    stop_us = now_us;
+	}
+    }
+}
+
+/*
+ * Lets the slaves react to a change of the lines from the given levels
+ */
+static void settle(uint8_t old_scl, uint8_t old_sda)
+{
+    uint8_t scl = scl_level();
+    uint8_t sda = sda_level();
+    if (scl == old_scl && sda == old_sda) {
+	return;
+    }
+
+    /*
+     * A START on several lanes at once is one transaction
+     */
+    if (scl && old_scl && (old_sda & ~sda)) {
+	stats.transactions++;
+    }
+    check_timing(scl, sda, old_scl, old_sda);
+
+    /*
+     * Count the edges once the slaves have reacted, so that their own
+     * changes of SDA are included
+     */
+    sim_bmp180_bus(scl, sda, old_scl, old_sda);
+    stats.edges += (scl != old_scl) + __builtin_popcount(sda_level() ^ old_sda);
+}
+
+/*
+ * Applies a change by the master and lets the slaves react to it
+ */
+static void sim_change(uint8_t scl_low, uint8_t sda_pins)
+{
+    uint8_t old_scl = scl_level();
+    uint8_t old_sda = sda_level();
+
+    master_scl_low = scl_low;
+    master_sda_pins = sda_pins;
+    settle(old_scl, old_sda);
+}
+
+void sim_scl(uint8_t low)
+{
+    sim_change(low, master_sda_pins);
+}
+
+void sim_sda(uint8_t low)
+{
+    sim_sda_lanes(1 << SIM_SDA_PIN, low ? 1 << SIM_SDA_PIN : 0);
+}
+
+uint8_t sim_sda_read(void)
+{
+    return (sda_level() >> SIM_SDA_PIN) & 1;
+}
+
+void sim_sda_lanes(uint8_t pins, uint8_t low)
+{
+    sim_change(master_scl_low, (master_sda_pins & ~pins) | low);
+}
+
+uint8_t sim_sda_lanes_read(void)
+{
+    return sda_level();
+}
+
+uint8_t sim_scl_read(void)
+{
+    /*
+     * A slave stretching the clock lets SCL rise once it has held it long
+     * enough, which the other slaves see as a rising edge
+     */
+    if (!master_scl_low && sim_bmp180_scl_low()) {
+	uint8_t old_sda = sda_level();
+
+	sim_bmp180_scl_poll();
+	settle(0, old_sda);
+    }
+    return scl_level();
+}
+
+void sim_delay_us(double us)
+{
+    now_us += us;
+    stats.bus_us += us;
+}
+
+void sim_idle_us(double us)
+{
+    now_us += us;
+}
+
+double sim_time_us(void)
+{
+    return now_us;
+}
+
+void sim_count_byte(uint8_t acknowledged)
+{
+    stats.bytes++;
+    if (!acknowledged) {
+	stats.naks++;
+    }
+}
+
+struct sim_stats sim_take_stats(void)
+{
+    struct sim_stats taken = stats;
+    stats = (struct sim_stats) {0};
+    return taken;
+}
+
+/*
+ * The millisecond clock of src/timer.c follows the simulated time
+ */
+uint32_t timer_millis(void)
+{
+    return (uint32_t) (now_us / 1000);
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+
+#include "bmp180.h"
+#include "telemetry.h"
+#include "telemetry_decode.h"
+
+/*
+ * Sends samples with the frame encoder of src/telemetry.c, as sample frames
+ * and as delta frames, and checks that the host decoder gives them back
+ */
+
+static struct telemetry_decoder decoder;
+static struct telemetry_record record;
+static unsigned records;
+
+/*
+ * Feeds what the encoder sends to the decoder instead of queueing it for the
+ * UART
+ */
+void usi_send_byte(char byte)
+{
+    if (telemetry_decoder_feed(&decoder, (uint8_t) byte, &record)) {
+	records++;
+    }
+}
+
+/*
+ * Sends a sample and checks that it decodes to a record of the given type
+ * with the same values
+ */
+static int check(const char *name, uint8_t delta, uint8_t type, int32_t temperature, int32_t pressure)
+{
+    struct bmp180_measurements measurements = { .temperature = temperature, .pressure = pressure };
+    unsigned before = records;
+
+    if (delta) {
+	telemetry_send_delta(&measurements);
+    } else {
+	telemetry_send(&measurements);
+    }
+
+    printf("%-26s %5u %4u %7ld %7ld\n", name, record.sequence, record.type,
+	    (long) record.temperature, (long) record.pressure);
+    if (records != before + 1 || record.type != type
+	    || record.temperature != temperature || record.pressure != pressure) {
+	fprintf(stderr, "%s: expected a frame of type %u with %ld and %ld\n", name, type, (long) temperature, (long) pressure);
+	return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    int failed = 0;
+
+    telemetry_decoder_init(&decoder);
+    printf("%-26s %5s %4s %7s %7s\n", "frame", "seq", "type", "T", "p");
+
+    failed |= check("sample", 0, TELEMETRY_SAMPLE, 150, 69964);
+    failed |= check("delta", 1, TELEMETRY_DELTA, 152, 69950);
+    failed |= check("delta, negative", 1, TELEMETRY_DELTA, 152 - 128, 69950 - 32768);
+
+    /*
+     * Changes too large for a delta frame, and zero bytes in every field
+     */
+    failed |= check("delta too large for T", 1, TELEMETRY_SAMPLE, -272, 37182);
+    failed |= check("delta too large for p", 1, TELEMETRY_SAMPLE, -272, 110000);
+    failed |= check("zero fields", 0, TELEMETRY_SAMPLE, 0, 0);
+    failed |= check("delta of zero", 1, TELEMETRY_DELTA, 0, 0);
+
+    /*
+     * A keyframe is sent after TELEMETRY_KEYFRAME_INTERVAL delta frames
+     */
+    failed |= check("sample", 0, TELEMETRY_SAMPLE, 850, 30000);
+    for (unsigned i = 0; i < TELEMETRY_KEYFRAME_INTERVAL; i++) {
+	failed |= check("delta", 1, TELEMETRY_DELTA, 850, 30001 + i);
+    }
+    failed |= check("keyframe", 1, TELEMETRY_SAMPLE, 850, 30001 + TELEMETRY_KEYFRAME_INTERVAL);
+
+    printf("%lu frames, %lu invalid, %lu lost, %lu unresolved\n", decoder.frames, decoder.errors, decoder.lost, decoder.unresolved);
+    failed |= decoder.errors || decoder.lost || decoder.unresolved;
+    return failed;
+}
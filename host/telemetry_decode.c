@@ -0,0 +1,168 @@
+#include "telemetry_decode.h"
+
+/*
+ * Initialises the decoder
+ */
+void telemetry_decoder_init(struct telemetry_decoder *decoder)
+{
+    decoder->length = 0;
+    decoder->overflow = 0;
+    decoder->frames = 0;
+    decoder->errors = 0;
+    decoder->lost = 0;
+    decoder->unresolved = 0;
+    decoder->started = 0;
+    decoder->resolved = 0;
+}
+
+/*
+ * Reverses the COBS encoding. Returns the decoded length, or 0 if the
+ * encoding is invalid.
+ */
+static size_t cobs_decode(const uint8_t *encoded, size_t length, uint8_t *frame, size_t size)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < length) {
+	uint8_t code = encoded[in++];
+	if (code == 0 || in + code - 1 > length) {
+	    return 0;
+	}
+
+	for (uint8_t i = 1; i < code; i++) {
+	    if (out == size) {
+		return 0;
+	    }
+	    frame[out++] = encoded[in++];
+	}
+
+	/*
+	 * Every block but the last stands for a zero
+	 */
+	if (code < 0xFF && in < length) {
+	    if (out == size) {
+		return 0;
+	    }
+	    frame[out++] = 0;
+	}
+    }
+    return out;
+}
+
+static int32_t read_le(const uint8_t *bytes, uint8_t count)
+{
+    uint32_t value = 0;
+
+    for (uint8_t i = count; i > 0; i--) {
+	value = value << 8 | bytes[i - 1];
+    }
+    return (int32_t) value;
+}
+
+/*
+ * Decodes one COBS-encoded frame, without its delimiter, into a record
+ */
+int telemetry_decode_frame(const uint8_t *encoded, size_t length, struct telemetry_record *record)
+{
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+    size_t frame_length = cobs_decode(encoded, length, frame, sizeof(frame));
+    uint16_t crc = TELEMETRY_CRC_INIT;
+
+    if (frame_length < 5) {
+	return 0;
+    }
+
+    for (size_t i = 0; i < frame_length - 2; i++) {
+	crc = telemetry_crc_update(crc, frame[i]);
+    }
+    if (crc != (uint16_t) read_le(&frame[frame_length - 2], 2)) {
+	return 0;
+    }
+
+    record->type = frame[0];
+    record->sequence = (uint16_t) read_le(&frame[1], 2);
+
+    switch (record->type) {
+	case TELEMETRY_SAMPLE:
+	    if (frame_length != 3 + TELEMETRY_SAMPLE_FIELDS + 2) {
+		return 0;
+	    }
+	    record->temperature = (int16_t) read_le(&frame[3], 2);
+	    record->pressure = read_le(&frame[5], 3);
+	    return 1;
+
+	case TELEMETRY_DELTA:
+	    if (frame_length != 3 + TELEMETRY_DELTA_FIELDS + 2) {
+		return 0;
+	    }
+	    record->temperature = (int8_t) frame[3];
+	    record->pressure = (int16_t) read_le(&frame[4], 2);
+	    return 1;
+
+	default:
+	    return 0;
+    }
+}
+
+/*
+ * Feeds a byte to the decoder
+ */
+int telemetry_decoder_feed(struct telemetry_decoder *decoder, uint8_t byte, struct telemetry_record *record)
+{
+    if (byte != 0) {
+	if (decoder->length == sizeof(decoder->encoded)) {
+	    decoder->overflow = 1;
+	} else {
+	    decoder->encoded[decoder->length++] = byte;
+	}
+	return 0;
+    }
+
+    /*
+     * A delimiter ends the frame, valid or not
+     */
+    int valid = 0;
+    if (decoder->length > 0) {
+	valid = !decoder->overflow && telemetry_decode_frame(decoder->encoded, decoder->length, record);
+	if (valid) {
+	    decoder->frames++;
+	} else {
+	    decoder->errors++;
+	}
+    }
+
+    decoder->length = 0;
+    decoder->overflow = 0;
+    if (!valid) {
+	return 0;
+    }
+
+    /*
+     * Count the gap in the sequence numbers of every valid frame, resolved
+     * or not, so that an unresolved delta is not counted as lost as well
+     */
+    if (decoder->started && record->sequence != decoder->next_sequence) {
+	decoder->lost += (uint16_t) (record->sequence - decoder->next_sequence);
+    }
+    decoder->next_sequence = record->sequence + 1;
+    decoder->started = 1;
+
+    /*
+     * A delta applies to the record with the previous sequence number, so
+     * it cannot be resolved after a lost frame until the next sample frame
+     */
+    if (record->type == TELEMETRY_DELTA) {
+	if (!decoder->resolved || record->sequence != (uint16_t) (decoder->last.sequence + 1)) {
+	    decoder->resolved = 0;
+	    decoder->unresolved++;
+	    return 0;
+	}
+	record->temperature += decoder->last.temperature;
+	record->pressure += decoder->last.pressure;
+    }
+
+    decoder->last = *record;
+    decoder->resolved = 1;
+    return 1;
+}
@@ -0,0 +1,58 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef TELEMETRY_DECODE_H
+#define TELEMETRY_DECODE_H
+
+#include "telemetry.h"
+
+/*
+ * Represents a decoded telemetry record. A delta frame decoded on its own
+ * holds the changes; fed through a decoder it holds the values.
+ */
+struct telemetry_record {
+    uint8_t type;
+    uint16_t sequence;
+    int32_t temperature;
+    int32_t pressure;
+};
+
+/*
+ * Represents the state of a telemetry decoder fed from a byte stream
+ */
+struct telemetry_decoder {
+    uint8_t encoded[TELEMETRY_ENCODED_MAX];
+    size_t length;
+    uint8_t overflow;
+    unsigned long frames;
+    unsigned long errors;
+    unsigned long lost;
+    unsigned long unresolved;
+    uint16_t next_sequence;
+    uint8_t started;
+    uint8_t resolved;
+    struct telemetry_record last;
+};
+
+/*
+ * Initialises the decoder
+ */
+void telemetry_decoder_init(struct telemetry_decoder *decoder);
+
+/*
+ * Feeds a byte to the decoder. Returns 1 and fills in the record when the
+ * byte completes a valid frame, 0 otherwise. Frames that are too long, fail
+ * to decode or fail the CRC are counted in the decoder's errors, and the
+ * sequence numbers missing between valid frames in its lost frames. Delta
+ * frames are applied to the previous record, and are counted as unresolved
+ * when it was lost.
+ */
+int telemetry_decoder_feed(struct telemetry_decoder *decoder, uint8_t byte, struct telemetry_record *record);
+
+/*
+ * Decodes one COBS-encoded frame, without its delimiter, into a record.
+ * Returns 1 if the frame is valid, 0 otherwise.
+ */
+int telemetry_decode_frame(const uint8_t *encoded, size_t length, struct telemetry_record *record);
+
+#endif
@@ -0,0 +1,119 @@
+#include "altitude.h"
+#include "hal.h"
+
+/*
+ * The table holds the altitude in cm every 2^STEP_SHIFT Pa from P_MIN, so the
+ * index and the interpolation weight come from shifts and masks
+ */
+#define P_MIN      30000
+#define STEP_SHIFT 10
+#define STEP       (1L << STEP_SHIFT)
+#define ENTRIES    80
+#define P_MAX      110000
+
+static const int32_t altitude_table[ENTRIES] PROGMEM = {
+    916516, 893984, 872047, 850670, 829822, 809475, 789604, 770183,
+    751190, 732606, 714410, 696585, 679116, 661985, 645179, 628685,
+    612489, 596581, 580948, 565580, 550468, 535603, 520974, 506575,
+    492397, 478433, 464676, 451118, 437755, 424578, 411584, 398766,
+    386118, 373637, 361317, 349153, 337142, 325279, 313560, 301981,
+    290538, 279228, 268048, 256994, 246064, 235253, 224559, 213980,
+    203513, 193155, 182903, 172755, 162709, 152763, 142914, 133161,
+    123500, 113931, 104452, 95060, 85753, 76531, 67391, 58331,
+    49351, 40448, 31622, 22870, 14191, 5585, -2951, -11418,
+    -19817, -28148, -36415, -44616, -52754, -60830, -68844, -76799,
+};
+
+/*
+ * Station pressure to sea level pressure ratio in 16.16 fixed point
+ */
+static uint32_t qnh_factor = 1UL << 16;
+
+static int32_t altitude_entry(uint8_t index)
+{
+    return (int32_t) pgm_read_dword(&altitude_table[index]);
+}
+
+/*
+ * Returns the altitude in 0.1 m at the given pressure in Pa
+ */
+int32_t altitude_from_pressure(int32_t pressure)
+{
+    if (pressure < P_MIN) {
+	pressure = P_MIN;
+    } else if (pressure > P_MAX) {
+	pressure = P_MAX;
+    }
+
+    uint32_t offset = pressure - P_MIN;
+    uint8_t index = offset >> STEP_SHIFT;
+    int32_t weight = offset & (STEP - 1);
+    int32_t low = altitude_entry(index);
+    int32_t high = altitude_entry(index + 1);
+
+    /*
+     * Interpolate in cm, then round to 0.1 m
+     */
+    int32_t altitude = low + (((high - low) * weight) >> STEP_SHIFT);
+    return (altitude + 5) / 10;
+}
+
+/*
+ * Returns the pressure in Pa at the given altitude in 0.1 m
+ */
+int32_t altitude_to_pressure(int32_t altitude)
+{
+    int32_t centimetres = altitude * 10;
+    uint8_t index = 0;
+
+    /*
+     * The altitude falls as the pressure rises, so find the first entry
+     * below it
+     */
+    while (index < ENTRIES - 2 && altitude_entry(index + 1) > centimetres) {
+	index++;
+    }
+
+    int32_t low = altitude_entry(index);
+    int32_t high = altitude_entry(index + 1);
+    if (centimetres > low) {
+	return P_MIN;
+    }
+    if (centimetres < high) {
+	return P_MAX;
+    }
+
+    int32_t pressure = P_MIN + ((int32_t) index << STEP_SHIFT) + (((low - centimetres) << STEP_SHIFT) + (low - high) / 2) / (low - high);
+    return pressure > P_MAX ? P_MAX : pressure;
+}
+
+/*
+ * Sets the altitude of the station in 0.1 m
+ */
+void altitude_set_station(int32_t altitude)
+{
+    uint32_t pressure = altitude_to_pressure(altitude);
+
+    /*
+     * 101325 / pressure in 16.16 fixed point, without overflowing 32 bits:
+     * divide 101325 * 2^14 first and carry the remainder into the last two
+     * bits
+     */
+    uint32_t quotient = (101325UL << 14) / pressure;
+    uint32_t remainder = (101325UL << 14) % pressure;
+    qnh_factor = (quotient << 2) + ((remainder << 2) + pressure / 2) / pressure;
+}
+
+/*
+ * Returns the given pressure in Pa at the station reduced to sea level
+ */
+int32_t altitude_qnh(int32_t pressure)
+{
+    uint32_t magnitude = pressure;
+
+    /*
+     * Multiply by the 16.16 factor in two halves so that neither product
+     * overflows 32 bits
+     */
+    return (((magnitude >> 8) * qnh_factor) >> 8) + (((magnitude & 0xFF) * qnh_factor + 0x8000) >> 16);
+}
@@ -0,0 +1,45 @@
+#include <stdint.h>
+
+#ifndef ALTITUDE_H
+#define ALTITUDE_H
+
+/*
+ * Altitude and sea level pressure in the standard atmosphere, interpolated
+ * from a table of h = 44330 * (1 - (p / 101325)^(1 / 5.255)) for pressures of
+ * 30 to 110 kPa. Pressures outside the range are clamped to it.
+ *
+ * Against the formula in double precision (host/altitude-check), over 30 to
+ * 110 kPa:
+ * - altitude_from_pressure() is within 0.9 m, and within 0.25 m above 70 kPa
+ * - altitude_to_pressure() is within 4 Pa
+ * - altitude_qnh() is within 4 Pa for stations up to 3000 m
+ */
+
+/*
+ * Default altitude of the station in 0.1 m, used for the sea level pressure
+ */
+#ifndef STATION_ALTITUDE
+#define STATION_ALTITUDE 0
+#endif
+
+/*
+ * Returns the altitude in 0.1 m at the given pressure in Pa
+ */
+int32_t altitude_from_pressure(int32_t pressure);
+
+/*
+ * Returns the pressure in Pa at the given altitude in 0.1 m
+ */
+int32_t altitude_to_pressure(int32_t altitude);
+
+/*
+ * Sets the altitude of the station in 0.1 m, for altitude_qnh()
+ */
+void altitude_set_station(int32_t altitude);
+
+/*
+ * Returns the given pressure in Pa at the station reduced to sea level (QNH)
+ */
+int32_t altitude_qnh(int32_t pressure);
+
+#endif
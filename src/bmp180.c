@@ -1,470 +1,724 @@
-#include <avr/io.h>
-#include <util/delay.h>
-
 #include "bmp180.h"
+#include "hal.h"
 #include "i2c.h"
+#include "profile.h"
+#include "timer.h"
+
+/*
+ * Pressure conversion times in milliseconds for each oversampling setting,
+ * rounded up from 4.5, 7.5, 13.5 and 25.5ms
+ */
+const uint8_t bmp180_conversion_times[] = { 5, 8, 14, 26 };
+
+/*
+ * Start of conversion bit of the control register, cleared by the sensor when
+ * the conversion is complete
+ */
+#define SCO (1 << 5)
+
+/*
+ * Post-delay of a step that starts a pressure conversion. The oversampling
+ * setting is added to the command, and the delay is the conversion time of
+ * the setting.
+ */
+#define STEP_DELAY_OSS 0xFF
+
+#define STEPS(steps) (sizeof(steps) / sizeof(steps[0]))
+
+/*
+ * Offsets of the first and last calibration words, read on identification to
+ * check the calibration data saved in EEPROM against the sensor
+ */
+#define CALIBRATION_AC1 0
+#define CALIBRATION_MD  20
+
+/*
+ * The register transfers of each sequence. Reads fill in the register image
+ * using the sensor's register auto-increment, writes send a command.
+ */
+static const struct bmp180_step identify_steps[] PROGMEM = {
+    { 0xD0, 1, BMP180_IMAGE_ID, 0 },
+    { 0xAA, 2, BMP180_IMAGE_CALIBRATION + CALIBRATION_AC1, 0 },
+    { 0xBE, 2, BMP180_IMAGE_CALIBRATION + CALIBRATION_MD, 0 },
+};
+
+static const struct bmp180_step calibrate_steps[] PROGMEM = {
+    { 0xAA, BMP180_CALIBRATION_LENGTH, BMP180_IMAGE_CALIBRATION, 0 },
+};
+
+static const struct bmp180_step measure_steps[] PROGMEM = {
+    { 0xF4, 0, 0x2E, 5 },
+    { 0xF6, 2, BMP180_IMAGE_UT, 0 },
+    { 0xF4, 0, 0x34, STEP_DELAY_OSS },
+    { 0xF6, 3, BMP180_IMAGE_UP, 0 },
+};
+
+/*
+ * The pressure half of measure_steps, for streaming with the last UT
+ */
+static const struct bmp180_step pressure_steps[] PROGMEM = {
+    { 0xF4, 0, 0x34, STEP_DELAY_OSS },
+    { 0xF6, 3, BMP180_IMAGE_UP, 0 },
+};
+
+/*
+ * Reads a big-endian word from the given bytes
+ */
+static uint16_t read_word(const uint8_t *bytes)
+{
+    return (uint16_t) bytes[0] << 8 | bytes[1];
+}
+
+/*
+ * Returns a calibration word from the register image
+ */
+static uint16_t image_word(const void *image, uint8_t offset)
+{
+    return read_word((const uint8_t *) image + BMP180_IMAGE_CALIBRATION + offset);
+}
+
+/*
+ * Represents the calibration data persisted in EEPROM
+ */
+struct bmp180_eeprom {
+    struct bmp180_calibration calibration;
+    uint8_t checksum;
+};
+
+static struct bmp180_eeprom EEMEM eeprom_calibration;
+
+/*
+ * Calculates the checksum of the calibration data, which guards against an
+ * erased or partly written record
+ */
+static uint8_t calibration_checksum(const struct bmp180_calibration *calibration)
+{
+    const uint8_t *bytes = (const uint8_t *) calibration;
+    uint8_t checksum = 0;
+
+    for (uint8_t i = 0; i < sizeof(*calibration); i++) {
+	checksum = _crc8_ccitt_update(checksum, bytes[i]);
+    }
+    return checksum;
+}
+
+/*
+ * Loads the calibration data from EEPROM if it was saved for the sensor on
+ * the bus. Every BMP180 has the same chip ID, so the saved AC1 and MD are
+ * compared with the ones just read from the sensor instead; a replaced sensor
+ * is then calibrated afresh.
+ */
+static uint8_t calibration_load(struct bmp180_context *context)
+{
+    struct bmp180_eeprom record;
+
+    eeprom_read_block(&record, &eeprom_calibration, sizeof(record));
+    if (record.checksum != calibration_checksum(&record.calibration)
+	    || (uint16_t) record.calibration.ac1 != image_word(context->image, CALIBRATION_AC1)
+	    || (uint16_t) record.calibration.md != image_word(context->image, CALIBRATION_MD)) {
+	return 0;
+    }
+
+    context->calibration = record.calibration;
+    return 1;
+}
 
-#define OSS 0
-
-#define CALIBRATION_MEASUREMENTS_STATE_CASE(CALIB_ID, MEASUREMENT_FIELD, TYPE, NEXT_CALIB_ID) \
-		    case M_READ_##CALIB_ID##_MSB: \
-			MEASUREMENT_FIELD = (TYPE) read_data.byte << 8; \
-			measurements_state = M_READ_##CALIB_ID##_LSB; \
-			break; \
-		    case M_READ_##CALIB_ID##_LSB: \
-			MEASUREMENT_FIELD |= (TYPE) read_data.byte; \
-			measurements_state = M_READ_##NEXT_CALIB_ID##_MSB; \
-			break; \
-
-#define CALIBRATION_REGISTER_WRITE_CASE(CALIB_ID, REGISTER_MSB, REGISTER_LSB) \
-	    case CALIB_ID##_MSB_REGISTER: \
-		if (write_data.state == W_NONE) { \
-		    write_data.byte = REGISTER_MSB; \
-		    write_data.bit_counter = 8; \
-		    write_data.success_state = RESTART; \
-		    write_data.error_state = STOP; \
-		    write_data.state = W_WRITE; \
-		} \
-		i2c_write(&write_data, &i2c_state); \
-		break; \
-	    case CALIB_ID##_LSB_REGISTER: \
-		if (write_data.state == W_NONE) { \
-		    write_data.byte = REGISTER_LSB; \
-		    write_data.bit_counter = 8; \
-		    write_data.success_state = RESTART; \
-		    write_data.error_state = STOP; \
-		    write_data.state = W_WRITE; \
-		} \
-		i2c_write(&write_data, &i2c_state); \
-		break; \
-
-#define CALIBRATION_SUCCESS_STATE_CASE(CALIB_ID) \
-			case M_READ_##CALIB_ID##_MSB: \
-			    write_data.success_state = CALIB_ID##_MSB_REGISTER; \
-			    break; \
-			case M_READ_##CALIB_ID##_LSB: \
-			    write_data.success_state = CALIB_ID##_LSB_REGISTER; \
-			    break; \
-
-/*
- * Starts the I2C processing
- */
-void bmp180_measure(struct bmp180_measurements *measurements)
+/*
+ * Saves the calibration data to EEPROM so that it is not read again after a
+ * reset
+ */
+static void calibration_save(struct bmp180_context *context)
 {
-    struct i2c_write_data write_data = { .state = W_NONE };
-    struct i2c_read_data read_data = { .state = R_NONE };
+    struct bmp180_eeprom record;
 
-    enum i2c_state i2c_state = NONE;
-    enum measurements_state measurements_state = M_NONE;
+    record.calibration = context->calibration;
+    record.checksum = calibration_checksum(&record.calibration);
+    eeprom_update_block(&record, &eeprom_calibration, sizeof(record));
+}
 
-    while (measurements_state != M_STOP) {
-	switch (i2c_state) {
+/*
+ * Returns non-zero once the conversion started by the last command has had the
+ * given number of milliseconds to complete. The first call while not waiting
+ * notes the start of the conversion.
+ */
+uint8_t bmp180_conversion_elapsed(uint8_t *waiting, uint32_t *start, uint8_t ms)
+{
+    if (!*waiting) {
+	*waiting = 1;
+	*start = timer_millis();
+    }
+
+    /*
+     * The clock may tick just after the conversion started, so wait for one
+     * more tick than requested.
+     */
+    if (timer_millis() - *start <= ms) {
+	return 0;
+    }
+
+    *waiting = 0;
+    return 1;
+}
+
+/*
+ * Returns the given oversampling mode, or the highest for a value out of
+ * range
+ */
+enum bmp180_mode bmp180_clamp_mode(enum bmp180_mode mode)
+{
+    return mode > BMP180_ULTRA_HIGH_RESOLUTION ? BMP180_ULTRA_HIGH_RESOLUTION : mode;
+}
+
+/*
+ * Returns non-zero when the control register is due to be read for the end
+ * of the conversion: once the typical conversion time of the datasheet, about
+ * two thirds of the given maximum, has passed, and then at most once per
+ * millisecond tick
+ */
+static uint8_t conversion_poll_due(struct bmp180_context *context, uint8_t ms)
+{
+    uint32_t now = timer_millis();
+
+    if (now - context->conversion_start < ms * 2 / 3 || (uint8_t) now == context->polled) {
+	return 0;
+    }
+
+    context->polled = now;
+    return 1;
+}
+
+/*
+ * Initialises the context so that the calibration data is read on the first
+ * measurements
+ */
+void bmp180_init(struct bmp180_context *context)
+{
+    context->calibrated = 0;
+    context->mode = BMP180_OSS;
+    context->eoc_polling = BMP180_EOC_POLLING;
+    context->stream_samples = BMP180_STREAM_SAMPLES;
+    context->stream_ms = BMP180_STREAM_MS;
+    context->ut_valid = 0;
+    context->b5_valid = 0;
+}
+
+/*
+ * Sets the oversampling mode of the next measurements, the highest for a
+ * value out of range
+ */
+void bmp180_set_mode(struct bmp180_context *context, enum bmp180_mode mode)
+{
+    context->mode = bmp180_clamp_mode(mode);
+}
+
+/*
+ * Sets whether the end of conversion is detected by polling the control
+ * register instead of waiting the full conversion time
+ */
+void bmp180_set_eoc_polling(struct bmp180_context *context, uint8_t enabled)
+{
+    context->eoc_polling = enabled;
+}
+
+/*
+ * Sets how long UT is reused for: up to the given number of pressure-only
+ * measurements, and up to the given number of milliseconds
+ */
+void bmp180_set_streaming(struct bmp180_context *context, uint8_t samples, uint16_t ms)
+{
+    context->stream_samples = samples;
+    context->stream_ms = ms;
+}
+
+/*
+ * Prepares the context for a new set of measurements
+ */
+void bmp180_start(struct bmp180_context *context, struct bmp180_measurements *measurements)
+{
+    context->measurements = measurements;
+    context->write_data.state = W_NONE;
+    context->read_data.state = R_NONE;
+    context->i2c_state = NONE;
+    context->measurements_state = M_NONE;
+    context->step_state = STEP_NONE;
+    context->steps = 0;
+    context->waiting = 0;
+    context->retries = BMP180_RETRIES;
+}
+
+/*
+ * Loads the first step of the sequence for the current measurements state
+ */
+static void sequence_load(struct bmp180_context *context)
+{
+    switch (context->measurements_state) {
+	case M_IDENTIFY:
+	    context->step = identify_steps;
+	    context->steps = STEPS(identify_steps);
+	    break;
+
+	case M_CALIBRATE:
+	    context->step = calibrate_steps;
+	    context->steps = STEPS(calibrate_steps);
+	    break;
+
+	case M_MEASURE:
+	    context->step = measure_steps;
+	    context->steps = STEPS(measure_steps);
+	    break;
+
+	case M_PRESSURE:
+	    context->step = pressure_steps;
+	    context->steps = STEPS(pressure_steps);
+	    break;
+
+	default:
+	    context->steps = 0;
+	    break;
+    }
+}
+
+/*
+ * Returns the state that measures with a fresh UT, or with the last one while
+ * it is recent enough
+ */
+static enum measurements_state measure_state(struct bmp180_context *context)
+{
+    if (context->ut_valid
+	    && context->ut_age < context->stream_samples
+	    && timer_millis() - context->ut_time < context->stream_ms) {
+	context->ut_age++;
+	return M_PRESSURE;
+    }
+    return M_MEASURE;
+}
+
+/*
+ * Uses the register image filled in by the sequence that has just completed,
+ * and determines the next sequence
+ */
+static void sequence_complete(struct bmp180_context *context)
+{
+    struct bmp180_measurements *measurements = context->measurements;
+    const uint8_t *image = context->image;
+
+    switch (context->measurements_state) {
+	case M_NONE:
+	    /*
+	     * The calibration data only needs to be read once
+	     */
+	    if (context->calibrated) {
+		context->measurements_state = measure_state(context);
+	    } else {
+		context->measurements_state = M_IDENTIFY;
+	    }
+	    break;
+
+	case M_IDENTIFY:
+	    context->chip_id = image[BMP180_IMAGE_ID];
+	    if (context->chip_id != BMP180_CHIP_ID) {
+		context->measurements_state = M_ERROR;
+	    } else if (calibration_load(context)) {
+		context->calibrated = 1;
+		context->measurements_state = M_MEASURE;
+	    } else {
+		context->measurements_state = M_CALIBRATE;
+	    }
+	    break;
+
+	case M_CALIBRATE:
+	    bmp180_decode_calibration(&context->calibration, image_word, image);
+	    calibration_save(context);
+	    context->calibrated = 1;
+	    context->measurements_state = M_MEASURE;
+	    break;
+
+	case M_MEASURE:
+	    context->ut = read_word(&image[BMP180_IMAGE_UT]);
+	    context->ut_time = timer_millis();
+	    context->ut_age = 0;
+	    context->ut_valid = 1;
+	    /* fall through */
+
+	case M_PRESSURE:
+	    measurements->ut = context->ut;
+	    image += BMP180_IMAGE_UP;
+	    measurements->up = (int32_t) image[0] << 16 | (int32_t) image[1] << 8 | image[2];
+	    measurements->up = measurements->up >> (8 - measurements->oss);
+	    context->measurements_state = M_STOP;
+	    break;
+
+	default:
+	    break;
+    }
+
+    if (context->measurements_state == M_MEASURE || context->measurements_state == M_PRESSURE) {
+	measurements->oss = context->mode;
+    }
+    sequence_load(context);
+}
+
+/*
+ * Moves on to the transfer after the one that has just completed. Returns
+ * zero if the sensor is still converting and there is nothing to transfer
+ * yet.
+ */
+static uint8_t step_next(struct bmp180_context *context)
+{
+    switch (context->step_state) {
+	case STEP_NONE:
+	    break;
+
+	case STEP_TRANSFER:
+	    if (context->transfer.delay == 0) {
+		break;
+	    }
+	    context->step_state = STEP_WAIT;
+	    /* fall through */
+
+	case STEP_WAIT:
+	    /*
+	     * Wait for the conversion time, or until the sensor reports the
+	     * end of the conversion
+	     */
+	    if (bmp180_conversion_elapsed(&context->waiting, &context->conversion_start, context->transfer.delay)) {
+		break;
+	    }
+	    if (!context->eoc_polling || !conversion_poll_due(context, context->transfer.delay)) {
+		return 0;
+	    }
+
+	    context->step_state = STEP_POLL;
+	    context->transfer.reg = 0xF4;
+	    context->transfer.length = 1;
+	    context->transfer.data = BMP180_IMAGE_CONTROL;
+	    return 1;
+
+	case STEP_POLL:
+	    if (context->image[BMP180_IMAGE_CONTROL] & SCO) {
+		context->step_state = STEP_WAIT;
+		return 0;
+	    }
+	    context->waiting = 0;
+	    break;
+    }
+
+    /*
+     * Take the next step of the sequence, moving on to the next sequence
+     * when there are none left
+     */
+    if (context->step_state != STEP_NONE) {
+	context->step++;
+	context->steps--;
+    }
+    while (context->steps == 0 && context->measurements_state != M_STOP && context->measurements_state != M_ERROR) {
+	sequence_complete(context);
+    }
+    if (context->measurements_state == M_STOP || context->measurements_state == M_ERROR) {
+	return 1;
+    }
+
+    memcpy_P(&context->transfer, context->step, sizeof(context->transfer));
+    if (context->transfer.delay == STEP_DELAY_OSS) {
+	context->transfer.data |= context->measurements->oss << 6;
+	context->transfer.delay = bmp180_conversion_times[context->measurements->oss];
+    }
+    context->step_state = STEP_TRANSFER;
+    return 1;
+}
+
+/*
+ * Advances the I2C processing until the measurements are complete or the
+ * sensor is busy converting
+ */
+enum bmp180_status bmp180_poll(struct bmp180_context *context)
+{
+    if (context->measurements_state == M_ERROR) {
+	return BMP180_ERROR;
+    }
+
+    while (context->measurements_state != M_STOP) {
+	switch (context->i2c_state) {
 	    case NONE:
 		i2c_init();
-		i2c_state = START;
+		context->i2c_state = START;
 		break;
 
 	    case START:
+		if (!step_next(context)) {
+		    PROFILE_ENTER(PROFILE_WAIT);
+		    return BMP180_BUSY;
+		}
+
 		/*
-		 * Determine the next state based on the current state
+		 * Something other than a BMP180 answered, and the bus is idle
 		 */
-		switch (measurements_state) {
-		    case M_NONE:
-			measurements_state = M_READ_ID;
-			break;
-
-		    case M_READ_ID:
-			measurements_state = M_READ_AC1_MSB;
-			break;
-
-		    CALIBRATION_MEASUREMENTS_STATE_CASE(AC1, measurements->ac1, int16_t, AC2)
-		    CALIBRATION_MEASUREMENTS_STATE_CASE(AC2, measurements->ac2, int16_t, AC3)
-		    CALIBRATION_MEASUREMENTS_STATE_CASE(AC3, measurements->ac3, int16_t, AC4)
-		    CALIBRATION_MEASUREMENTS_STATE_CASE(AC4, measurements->ac4, uint16_t, AC5)
-		    CALIBRATION_MEASUREMENTS_STATE_CASE(AC5, measurements->ac5, uint16_t, AC6)
-		    CALIBRATION_MEASUREMENTS_STATE_CASE(AC6, measurements->ac6, uint16_t, B1)
-		    CALIBRATION_MEASUREMENTS_STATE_CASE(B1, measurements->b1, int16_t, B2)
-		    CALIBRATION_MEASUREMENTS_STATE_CASE(B2, measurements->b2, int16_t, MB)
-		    CALIBRATION_MEASUREMENTS_STATE_CASE(MB, measurements->mb, int16_t, MC)
-		    CALIBRATION_MEASUREMENTS_STATE_CASE(MC, measurements->mc, int16_t, MD)
-
-		    case M_READ_MD_MSB:
-			measurements->md = read_data.byte << 8;
-			measurements_state = M_READ_MD_LSB;
-			break;
-
-		    case M_READ_MD_LSB:
-			measurements->md |= read_data.byte;
-			measurements_state = M_MEASURE_UT;
-			break;
-
-		    case M_MEASURE_UT:
-			/*
-			 * Wait 5ms before reading
-			 */
-			delay_ms(5);
-			measurements_state = M_READ_UT_MSB;
-			break;
-
-		    case M_READ_UT_MSB:
-			measurements->ut = (int32_t) read_data.byte << 8;
-			measurements_state = M_READ_UT_LSB;
-			break;
-
-		    case M_READ_UT_LSB:
-			measurements->ut |= (int32_t) read_data.byte;
-			measurements_state = M_MEASURE_UP;
-			break;
-
-		    case M_MEASURE_UP:
-			/*
-			 * Wait 80ms before reading
-			 */
-			delay_ms(80);
-			measurements_state = M_READ_UP_MSB;
-			break;
-
-		    case M_READ_UP_MSB:
-			measurements->up = (int32_t) read_data.byte << 16;
-			measurements_state = M_READ_UP_LSB;
-			break;
-
-		    case M_READ_UP_LSB:
-			measurements->up |= (int32_t) read_data.byte << 8;
-			measurements_state = M_READ_UP_XLSB;
-			break;
-
-		    case M_READ_UP_XLSB:
-			measurements->up |= (int32_t) read_data.byte;
-			measurements->up = measurements->up >> (8 - OSS);
-			measurements_state = M_STOP;
-			break;
-
-		    default:
-			break;
+		if (context->measurements_state == M_ERROR) {
+		    PROFILE_ENTER(PROFILE_OTHER);
+		    return BMP180_ERROR;
 		}
 
-		if (measurements_state != M_STOP) {
+		if (context->measurements_state != M_STOP) {
+		    PROFILE_ENTER(PROFILE_START);
 		    i2c_start();
-		    i2c_state = ADDRESS_WRITE;
+		    context->i2c_state = ADDRESS_WRITE;
 		} else {
-		    i2c_state = STOP;
+		    context->i2c_state = STOP;
 		}
 		break;
 
 	    case ADDRESS_WRITE:
-		if (write_data.state == W_NONE) {
-		    write_data.byte = 0xEE;
-		    write_data.bit_counter = 8;
-		    switch (measurements_state) {
-			case M_READ_ID:
-			    write_data.success_state = ID_REGISTER;
-			    break;
-
-			case M_MEASURE_UT:
-			case M_MEASURE_UP:
-			    write_data.success_state = CONTROL_REGISTER;
-			    break;
-
-			case M_READ_UT_MSB:
-			case M_READ_UP_MSB:
-			    write_data.success_state = MSB_REGISTER;
-			    break;
-
-			case M_READ_UT_LSB:
-			case M_READ_UP_LSB:
-			    write_data.success_state = LSB_REGISTER;
-			    break;
-
-			case M_READ_UP_XLSB:
-			    write_data.success_state = XLSB_REGISTER;
-			    break;
-
-			CALIBRATION_SUCCESS_STATE_CASE(AC1)
-			CALIBRATION_SUCCESS_STATE_CASE(AC2)
-			CALIBRATION_SUCCESS_STATE_CASE(AC3)
-			CALIBRATION_SUCCESS_STATE_CASE(AC4)
-			CALIBRATION_SUCCESS_STATE_CASE(AC5)
-			CALIBRATION_SUCCESS_STATE_CASE(AC6)
-			CALIBRATION_SUCCESS_STATE_CASE(B1)
-			CALIBRATION_SUCCESS_STATE_CASE(B2)
-			CALIBRATION_SUCCESS_STATE_CASE(MB)
-			CALIBRATION_SUCCESS_STATE_CASE(MC)
-			CALIBRATION_SUCCESS_STATE_CASE(MD)
-
-			default:
-			    write_data.success_state = STOP;
-			    break;
-		    }
-		    write_data.error_state = STOP;
-		    write_data.state = W_WRITE;
+		if (context->write_data.state == W_NONE) {
+		    PROFILE_ENTER(PROFILE_ADDRESS);
+		    context->write_data.byte = BMP180_WRITE;
+		    context->write_data.bit_counter = 8;
+		    context->write_data.success_state = REGISTER;
+		    context->write_data.error_state = RECOVER;
+		    context->write_data.state = W_WRITE;
 		}
-		i2c_write(&write_data, &i2c_state);
+		i2c_write(&context->write_data, &context->i2c_state);
 		break;
 
-	    case CONTROL_REGISTER:
-		if (write_data.state == W_NONE) {
-		    write_data.byte = 0xF4;
-		    write_data.bit_counter = 8;
-		    switch (measurements_state) {
-			case M_MEASURE_UT:
-			    write_data.success_state = MEASURE_UT;
-			    break;
-
-			case M_MEASURE_UP:
-			    write_data.success_state = MEASURE_UP;
-			    break;
-
-			default:
-			    write_data.success_state = STOP;
-			    break;
+	    case REGISTER:
+		if (context->write_data.state == W_NONE) {
+		    PROFILE_ENTER(PROFILE_WRITE);
+		    context->write_data.byte = context->transfer.reg;
+		    context->write_data.bit_counter = 8;
+		    if (context->transfer.length) {
+			context->write_data.success_state = RESTART;
+		    } else {
+			context->write_data.success_state = DATA_WRITE;
 		    }
-		    write_data.error_state = STOP;
-		    write_data.state = W_WRITE;
+		    context->write_data.error_state = RECOVER;
+		    context->write_data.state = W_WRITE;
 		}
-		i2c_write(&write_data, &i2c_state);
+		i2c_write(&context->write_data, &context->i2c_state);
 		break;
 
-	    case MEASURE_UT:
-		if (write_data.state == W_NONE) {
-		    write_data.byte = 0x2E;
-		    write_data.bit_counter = 8;
-		    write_data.success_state = STOP_START;
-		    write_data.error_state = STOP;
-		    write_data.state = W_WRITE;
+	    case DATA_WRITE:
+		if (context->write_data.state == W_NONE) {
+		    PROFILE_ENTER(PROFILE_WRITE);
+		    context->write_data.byte = context->transfer.data;
+		    context->write_data.bit_counter = 8;
+		    context->write_data.success_state = STOP_START;
+		    context->write_data.error_state = RECOVER;
+		    context->write_data.state = W_WRITE;
 		}
-		i2c_write(&write_data, &i2c_state);
-		break;
-
-	    case MEASURE_UP:
-		if (write_data.state == W_NONE) {
-		    write_data.byte = 0xF4;
-		    write_data.bit_counter = 8;
-		    write_data.success_state = STOP_START;
-		    write_data.error_state = STOP;
-		    write_data.state = W_WRITE;
-		}
-		i2c_write(&write_data, &i2c_state);
-		break;
-
-	    case MSB_REGISTER:
-		if (write_data.state == W_NONE) {
-		    write_data.byte = 0xF6;
-		    write_data.bit_counter = 8;
-		    write_data.success_state = RESTART;
-		    write_data.error_state = STOP;
-		    write_data.state = W_WRITE;
-		}
-		i2c_write(&write_data, &i2c_state);
-		break;
-
-	    case LSB_REGISTER:
-		if (write_data.state == W_NONE) {
-		    write_data.byte = 0xF7;
-		    write_data.bit_counter = 8;
-		    write_data.success_state = RESTART;
-		    write_data.error_state = STOP;
-		    write_data.state = W_WRITE;
-		}
-		i2c_write(&write_data, &i2c_state);
-		break;
-
-	    case XLSB_REGISTER:
-		if (write_data.state == W_NONE) {
-		    write_data.byte = 0xF8;
-		    write_data.bit_counter = 8;
-		    write_data.success_state = RESTART;
-		    write_data.error_state = STOP;
-		    write_data.state = W_WRITE;
-		}
-		i2c_write(&write_data, &i2c_state);
+		i2c_write(&context->write_data, &context->i2c_state);
 		break;
 
 	    case RESTART:
+		PROFILE_ENTER(PROFILE_RESTART);
 		i2c_start();
-		i2c_state = ADDRESS_READ;
+		context->i2c_state = ADDRESS_READ;
 		break;
 		
 	    case ADDRESS_READ:
-		if (write_data.state == W_NONE) {
-		    write_data.byte = 0xEF;
-		    write_data.bit_counter = 8;
-		    switch (measurements_state) {
-			case M_READ_ID:
-			    write_data.success_state = ID_READ;
-			    break;
-
-			case M_READ_AC1_MSB:
-			case M_READ_AC2_MSB:
-			case M_READ_AC3_MSB:
-			case M_READ_AC4_MSB:
-			case M_READ_AC5_MSB:
-			case M_READ_AC6_MSB:
-			case M_READ_B1_MSB:
-			case M_READ_B2_MSB:
-			case M_READ_MB_MSB:
-			case M_READ_MC_MSB:
-			case M_READ_MD_MSB:
-			case M_READ_UP_MSB:
-			case M_READ_UT_MSB:
-			    write_data.success_state = MSB_READ;
-			    break;
-
-			case M_READ_AC1_LSB:
-			case M_READ_AC2_LSB:
-			case M_READ_AC3_LSB:
-			case M_READ_AC4_LSB:
-			case M_READ_AC5_LSB:
-			case M_READ_AC6_LSB:
-			case M_READ_B1_LSB:
-			case M_READ_B2_LSB:
-			case M_READ_MB_LSB:
-			case M_READ_MC_LSB:
-			case M_READ_MD_LSB:
-			case M_READ_UP_LSB:
-			case M_READ_UT_LSB:
-			    write_data.success_state = LSB_READ;
-			    break;
-
-			case M_READ_UP_XLSB:
-			    write_data.success_state = XLSB_READ;
-			    break;
-
-			default:
-			    write_data.success_state = STOP;
-			    break;
-		    }
-		    write_data.error_state = STOP;
-		    write_data.state = W_WRITE;
+		if (context->write_data.state == W_NONE) {
+		    PROFILE_ENTER(PROFILE_ADDRESS);
+		    context->write_data.byte = BMP180_READ;
+		    context->write_data.bit_counter = 8;
+		    context->write_data.success_state = DATA_READ;
+		    context->write_data.error_state = RECOVER;
+		    context->write_data.state = W_WRITE;
+		    context->index = 0;
 		}
-		i2c_write(&write_data, &i2c_state);
+		i2c_write(&context->write_data, &context->i2c_state);
 		break;
 
-	    case MSB_READ:
-		if (read_data.state == R_NONE) {
-		    read_data.bit_counter = 0;
-		    read_data.send_nack = 1;
-		    read_data.success_state = STOP_START;
-		    read_data.state = R_READ;
+	    case DATA_READ:
+		if (context->read_data.state == R_NONE) {
+		    PROFILE_ENTER(PROFILE_READ);
+		    context->read_data.bit_counter = 0;
+
+		    /*
+		     * Acknowledge every byte but the last so that the sensor
+		     * carries on with the next register
+		     */
+		    if (context->index == context->transfer.length - 1) {
+			context->read_data.send_nack = 1;
+			context->read_data.success_state = STOP_START;
+		    } else {
+			context->read_data.send_nack = 0;
+			context->read_data.success_state = DATA_READ;
+		    }
+		    context->read_data.error_state = RECOVER;
+		    context->read_data.state = R_READ;
 		}
-		i2c_read(&read_data, &i2c_state);
-		break;
-
-	    case LSB_READ:
-		if (read_data.state == R_NONE) {
-		    read_data.bit_counter = 0;
-		    read_data.send_nack = 1;
-		    read_data.success_state = STOP_START;
-		    read_data.state = R_READ;
+		/*
+		 * Keep the byte only once it is read, and not after a bus
+		 * error, which leaves a byte cut short
+		 */
+		i2c_read(&context->read_data, &context->i2c_state);
+		if (context->read_data.state == R_NONE && context->i2c_state != RECOVER) {
+		    context->image[context->transfer.data + context->index++] = context->read_data.byte;
 		}
-		i2c_read(&read_data, &i2c_state);
 		break;
 
-	    case XLSB_READ:
-		if (read_data.state == R_NONE) {
-		    read_data.bit_counter = 0;
-		    read_data.send_nack = 1;
-		    read_data.success_state = STOP_START;
-		    read_data.state = R_READ;
-		}
-		i2c_read(&read_data, &i2c_state);
+	    case STOP:
+		i2c_stop();
 		break;
 
-	    case ID_REGISTER:
-		if (write_data.state == W_NONE) {
-		    write_data.byte = 0xD0;
-		    write_data.bit_counter = 8;
-		    write_data.success_state = RESTART;
-		    write_data.error_state = STOP;
-		    write_data.state = W_WRITE;
-		}
-		i2c_write(&write_data, &i2c_state);
+	    case STOP_START:
+		PROFILE_ENTER(PROFILE_STOP);
+		i2c_stop();
+		context->i2c_state = START;
 		break;
 
-	    case ID_READ:
-		if (read_data.state == R_NONE) {
-		    read_data.byte = 0;
-		    read_data.bit_counter = 0;
-		    read_data.send_nack = 1;
-		    read_data.success_state = STOP_START;
-		    read_data.state = R_READ;
+	    case RECOVER:
+		/*
+		 * Free the bus and repeat the transfer that failed, until the
+		 * retries run out
+		 */
+		PROFILE_ENTER(PROFILE_RECOVER);
+		i2c_recover();
+		if (context->retries == 0) {
+		    context->measurements_state = M_ERROR;
+		    PROFILE_ENTER(PROFILE_OTHER);
+		    return BMP180_ERROR;
 		}
-		i2c_read(&read_data, &i2c_state);
+		PROFILE_COUNT(PROFILE_RETRIES);
+		context->retries--;
+		context->write_data.state = W_NONE;
+		context->read_data.state = R_NONE;
+		PROFILE_ENTER(PROFILE_START);
+		i2c_start();
+		context->i2c_state = ADDRESS_WRITE;
 		break;
+	}
+    }
 
-	    CALIBRATION_REGISTER_WRITE_CASE(AC1, 0xAA, 0xAB)
-	    CALIBRATION_REGISTER_WRITE_CASE(AC2, 0xAC, 0xAD)
-	    CALIBRATION_REGISTER_WRITE_CASE(AC3, 0xAE, 0xAF)
-	    CALIBRATION_REGISTER_WRITE_CASE(AC4, 0xB0, 0xB1)
-	    CALIBRATION_REGISTER_WRITE_CASE(AC5, 0xB2, 0xB3)
-	    CALIBRATION_REGISTER_WRITE_CASE(AC6, 0xB4, 0xB5)
-	    CALIBRATION_REGISTER_WRITE_CASE(B1, 0xB6, 0xB7)
-	    CALIBRATION_REGISTER_WRITE_CASE(B2, 0xB8, 0xB9)
-	    CALIBRATION_REGISTER_WRITE_CASE(MB, 0xBA, 0xBB)
-	    CALIBRATION_REGISTER_WRITE_CASE(MC, 0xBC, 0xBD)
-	    CALIBRATION_REGISTER_WRITE_CASE(MD, 0xBE, 0xBF)
+    PROFILE_ENTER(PROFILE_OTHER);
+    return BMP180_READY;
+}
 
-	    case STOP:
-		i2c_stop();
-		break;
+/*
+ * Calculates the temperature and pressure from the completed measurements
+ */
+void bmp180_complete(struct bmp180_context *context)
+{
+    bmp180_compensate(context, context->measurements);
+}
 
-	    case STOP_START:
-		i2c_stop();
-		i2c_state = START;
-		break;
-	}
+/*
+ * Calculates the temperature and pressure of the given measurements with the
+ * calibration data of the context, reusing B5 while UT is unchanged
+ */
+void bmp180_compensate(struct bmp180_context *context, struct bmp180_measurements *measurements)
+{
+    PROFILE_ENTER(PROFILE_CALCULATE);
+    if (!context->b5_valid || context->b5_ut != measurements->ut) {
+	context->b5 = bmp180_calculate_b5(&context->calibration, measurements->ut);
+	context->b5_ut = measurements->ut;
+	context->b5_valid = 1;
     }
+    bmp180_calculate_pressure(&context->calibration, context->b5, measurements);
+    PROFILE_ENTER(PROFILE_OTHER);
+}
 
-    measurements_state = M_NONE;
-    bmp180_calculate(measurements);
+/*
+ * Starts the BMP180 measurements and waits for them to complete
+ */
+enum bmp180_status bmp180_measure(struct bmp180_measurements *measurements)
+{
+    static struct bmp180_context context;
+    static uint8_t initialised = 0;
+
+    if (!initialised) {
+	bmp180_init(&context);
+	initialised = 1;
+    }
+
+    enum bmp180_status status;
+
+    bmp180_start(&context, measurements);
+    while ((status = bmp180_poll(&context)) == BMP180_BUSY);
+    if (status == BMP180_READY) {
+	bmp180_complete(&context);
+    }
+    return status;
+}
+
+/*
+ * Decodes the calibration data, the eleven words from register 0xAA on
+ */
+void bmp180_decode_calibration(struct bmp180_calibration *calibration, bmp180_word_getter word, const void *source)
+{
+    calibration->ac1 = word(source, 0);
+    calibration->ac2 = word(source, 2);
+    calibration->ac3 = word(source, 4);
+    calibration->ac4 = word(source, 6);
+    calibration->ac5 = word(source, 8);
+    calibration->ac6 = word(source, 10);
+    calibration->b1 = word(source, 12);
+    calibration->b2 = word(source, 14);
+    calibration->mb = word(source, 16);
+    calibration->mc = word(source, 18);
+    calibration->md = word(source, 20);
 }
 
-void bmp180_calculate(struct bmp180_measurements *measurements)
+void bmp180_calculate(struct bmp180_calibration *calibration, struct bmp180_measurements *measurements)
 {
 #if 0
-    measurements->ac1 = 408;
-    measurements->ac2 = -72;
-    measurements->ac3 = -14383;
-    measurements->ac4 = 32741;
-    measurements->ac5 = 32757;
-    measurements->ac6 = 23153;
-    measurements->b1 = 6190;
-    measurements->b2 = 4;
-    measurements->mb = -32768;
-    measurements->mc = -8711;
-    measurements->md = 2868;
+    calibration->ac1 = 408;
+    calibration->ac2 = -72;
+    calibration->ac3 = -14383;
+    calibration->ac4 = 32741;
+    calibration->ac5 = 32757;
+    calibration->ac6 = 23153;
+    calibration->b1 = 6190;
+    calibration->b2 = 4;
+    calibration->mb = -32768;
+    calibration->mc = -8711;
+    calibration->md = 2868;
     measurements->ut = 27898;
     measurements->up = 23843;
+    measurements->oss = 0;
 #endif
 
-    /*
-     * Calculate temperature
-     */
-    int32_t x1 = (measurements->ut - measurements->ac6) * measurements->ac5 / pow(2, 15);
-    int32_t x2 = measurements->mc * pow(2, 11) / (x1 + measurements->md);
-    int32_t b5 = x1 + x2;
-    measurements->temperature = (b5 + 8) / pow(2, 4);
+    bmp180_calculate_pressure(calibration, bmp180_calculate_b5(calibration, measurements->ut), measurements);
+}
+
+/*
+ * The datasheet divisions by powers of two are done with right shifts.
+ * avr-gcc shifts signed values arithmetically, which is what the datasheet
+ * algorithm expects for negative intermediates.
+ */
+
+/*
+ * Calculates the B5 term of the temperature from UT
+ */
+int32_t bmp180_calculate_b5(const struct bmp180_calibration *calibration, int32_t ut)
+{
+    int32_t x1 = ((ut - calibration->ac6) * calibration->ac5) >> 15;
+    int32_t x2 = ((int32_t) calibration->mc << 11) / (x1 + calibration->md);
+    return x1 + x2;
+}
+
+/*
+ * Calculates the temperature from B5, and the pressure from B5 and UP
+ */
+void bmp180_calculate_pressure(const struct bmp180_calibration *calibration, int32_t b5, struct bmp180_measurements *measurements)
+{
+    measurements->temperature = (b5 + 8) >> 4;
 
-    /*
-     * Calculate pressure
-     */
     int32_t b6 = b5 - 4000;
-    x1 = (measurements->b2 * (b6 * b6 / pow(2, 12))) / pow(2, 11);
-    x2 = measurements->ac2 * b6 / pow(2, 11);
+    int32_t x1 = (calibration->b2 * ((b6 * b6) >> 12)) >> 11;
+    int32_t x2 = (calibration->ac2 * b6) >> 11;
     int32_t x3 = x1 + x2;
-    int32_t b3 = (((measurements->ac1 * 4 + x3) << OSS) + 2) / 4;
-    x1 = measurements->ac3 * b6 / pow(2, 13);
-    x2 = (measurements->b1 * (b6 * b6 / pow(2, 12))) / pow(2, 16);
-    x3 = (x1 + x2 + 2) / pow(2, 2);
-    uint32_t b4 = measurements->ac4 * (uint32_t) (x3 + 32768) / pow(2, 15);
-    uint32_t b7 = ((uint32_t) measurements->up - b3) * (50000 >> OSS);
+    int32_t b3 = ((((int32_t) calibration->ac1 * 4 + x3) << measurements->oss) + 2) >> 2;
+    x1 = (calibration->ac3 * b6) >> 13;
+    x2 = (calibration->b1 * ((b6 * b6) >> 12)) >> 16;
+    x3 = ((x1 + x2) + 2) >> 2;
+    uint32_t b4 = (calibration->ac4 * (uint32_t) (x3 + 32768)) >> 15;
+    uint32_t b7 = ((uint32_t) measurements->up - b3) * (50000 >> measurements->oss);
     if (b7 < 0x80000000) {
 	measurements->pressure = (b7 * 2) / b4;
     } else {
 	measurements->pressure = (b7 / b4) * 2;
     }
-    x1 = (measurements->pressure / pow(2, 8)) * (measurements->pressure / pow(2, 8));
-    x1 = (x1 * 3038) / pow(2, 16);
-    x2 = (-7357 * measurements->pressure) / pow(2, 16);
-    measurements->pressure += (x1 + x2 + 3791) / pow(2, 4);
+    x1 = (measurements->pressure >> 8) * (measurements->pressure >> 8);
+    x1 = (x1 * 3038) >> 16;
+    x2 = (-7357 * measurements->pressure) >> 16;
+    measurements->pressure += (x1 + x2 + 3791) >> 4;
 }
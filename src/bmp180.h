@@ -1,24 +1,115 @@
 #ifndef BMP180_H
 #define BMP180_H
 
-#ifdef I2C_STATE
-#undef I2C_STATE
+#include "i2c.h"
+#include "timer.h"
+
+/*
+ * Chip ID of every BMP180, read from register 0xD0
+ */
+#define BMP180_CHIP_ID 0x55
+
+/*
+ * Address bytes of the BMP180 for writing and reading
+ */
+#define BMP180_WRITE 0xEE
+#define BMP180_READ  0xEF
+
+/*
+ * Number of bytes of calibration data, starting at register 0xAA
+ */
+#define BMP180_CALIBRATION_LENGTH 22
+
+/*
+ * Offsets of the registers read into the register image of the context
+ */
+#define BMP180_IMAGE_ID          0
+#define BMP180_IMAGE_CALIBRATION 1
+#define BMP180_IMAGE_UT          (BMP180_IMAGE_CALIBRATION + BMP180_CALIBRATION_LENGTH)
+#define BMP180_IMAGE_UP          (BMP180_IMAGE_UT + 2)
+#define BMP180_IMAGE_CONTROL     (BMP180_IMAGE_UP + 3)
+#define BMP180_IMAGE_LENGTH      (BMP180_IMAGE_CONTROL + 1)
+
+/*
+ * Default oversampling setting (0-3), see enum bmp180_mode
+ */
+#ifndef BMP180_OSS
+#define BMP180_OSS 0
 #endif
 
-#define I2C_STATE \
-enum i2c_state { NONE, START, ADDRESS_WRITE, AC1_MSB_REGISTER, AC1_LSB_REGISTER, AC2_MSB_REGISTER, AC2_LSB_REGISTER, AC3_MSB_REGISTER, AC3_LSB_REGISTER, AC4_MSB_REGISTER, AC4_LSB_REGISTER, AC5_MSB_REGISTER, AC5_LSB_REGISTER, AC6_MSB_REGISTER, AC6_LSB_REGISTER, B1_MSB_REGISTER, B1_LSB_REGISTER, B2_MSB_REGISTER, B2_LSB_REGISTER, MB_MSB_REGISTER, MB_LSB_REGISTER, MC_MSB_REGISTER, MC_LSB_REGISTER, MD_MSB_REGISTER, MD_LSB_REGISTER, CONTROL_REGISTER, MEASURE_UT, MEASURE_UP, RESTART, MSB_REGISTER, LSB_REGISTER, XLSB_REGISTER, ADDRESS_READ, MSB_READ, LSB_READ, XLSB_READ, ID_REGISTER, ID_READ, STOP, STOP_START };
+#if BMP180_OSS > 3
+#error "BMP180_OSS must be from 0 to 3"
+#endif
 
-#include "i2c.h"
+/*
+ * Default end of conversion detection: 0 waits the full conversion time, 1
+ * polls the control register once per millisecond from the typical conversion
+ * time on, until the conversion is complete, falling back to the full
+ * conversion time as a timeout
+ */
+#ifndef BMP180_EOC_POLLING
+#define BMP180_EOC_POLLING 0
+#endif
+
+/*
+ * Default number of transfers that may fail on the bus in a set of
+ * measurements. Each failure frees the bus and repeats the transfer, so a set
+ * of measurements takes at most BMP180_RETRIES more transfers than usual.
+ */
+#ifndef BMP180_RETRIES
+#define BMP180_RETRIES 3
+#endif
+
+/*
+ * Default streaming: the number of measurements in a row that reuse the last
+ * UT and skip the temperature conversion, 0 for none, and the age in ms after
+ * which UT is measured again regardless
+ */
+#ifndef BMP180_STREAM_SAMPLES
+#define BMP180_STREAM_SAMPLES 0
+#endif
+
+#ifndef BMP180_STREAM_MS
+#define BMP180_STREAM_MS 1000
+#endif
 
 /*
  * Represents the state of the BMP180 measurements
  */
-enum measurements_state { M_NONE, M_READ_ID, M_READ_AC1_MSB, M_READ_AC1_LSB, M_READ_AC2_MSB, M_READ_AC2_LSB, M_READ_AC3_MSB, M_READ_AC3_LSB, M_READ_AC4_MSB, M_READ_AC4_LSB, M_READ_AC5_MSB, M_READ_AC5_LSB, M_READ_AC6_MSB, M_READ_AC6_LSB, M_READ_B1_MSB, M_READ_B1_LSB, M_READ_B2_MSB, M_READ_B2_LSB, M_READ_MB_MSB, M_READ_MB_LSB, M_READ_MC_MSB, M_READ_MC_LSB, M_READ_MD_MSB, M_READ_MD_LSB, M_MEASURE_UP, M_MEASURE_UT, M_READ_UP_MSB, M_READ_UP_LSB, M_READ_UP_XLSB, M_READ_UT_MSB, M_READ_UT_LSB, M_STOP };
+enum measurements_state { M_NONE, M_IDENTIFY, M_CALIBRATE, M_MEASURE, M_PRESSURE, M_STOP, M_ERROR };
 
 /*
- * Represents a set of BMP180 measurements
+ * Represents the state of the step of a sequence
  */
-struct bmp180_measurements {
+enum step_state { STEP_NONE, STEP_TRANSFER, STEP_WAIT, STEP_POLL };
+
+/*
+ * Represents a register transfer of a sequence: reads length bytes from reg
+ * into the register image at offset data, or writes data to reg if length is
+ * zero, then waits delay milliseconds
+ */
+struct bmp180_step {
+    uint8_t reg;
+    uint8_t length;
+    uint8_t data;
+    uint8_t delay;
+};
+
+/*
+ * Represents the BMP180 oversampling modes, trading conversion time and power
+ * for lower noise
+ */
+enum bmp180_mode { BMP180_ULTRA_LOW_POWER, BMP180_STANDARD, BMP180_HIGH_RESOLUTION, BMP180_ULTRA_HIGH_RESOLUTION };
+
+/*
+ * Pressure conversion times in milliseconds for each oversampling mode
+ */
+extern const uint8_t bmp180_conversion_times[];
+
+/*
+ * Represents the BMP180 calibration data
+ */
+struct bmp180_calibration {
     int16_t ac1;
     int16_t ac2;
     int16_t ac3;
@@ -30,25 +121,150 @@ struct bmp180_measurements {
     int16_t mb;
     int16_t mc;
     int16_t md;
+};
+
+/*
+ * Represents a set of BMP180 measurements
+ */
+struct bmp180_measurements {
     int32_t ut;
     int32_t up;
     int32_t temperature;
     int32_t pressure;
+    uint8_t oss;
 };
 
 /*
- * Starts the BMP180 measurements
+ * Represents the result of advancing the BMP180 measurements
+ */
+enum bmp180_status { BMP180_BUSY, BMP180_READY, BMP180_ERROR };
+
+/*
+ * Represents the context data of the BMP180 measurements in progress
+ */
+struct bmp180_context {
+    struct bmp180_calibration calibration;
+    uint8_t calibrated;
+    uint8_t chip_id;
+    enum bmp180_mode mode;
+    uint8_t eoc_polling;
+    uint8_t stream_samples;
+    uint16_t stream_ms;
+    uint8_t ut_valid;
+    uint8_t ut_age;
+    uint32_t ut_time;
+    int32_t ut;
+    uint8_t b5_valid;
+    int32_t b5_ut;
+    int32_t b5;
+    struct bmp180_measurements *measurements;
+    struct i2c_write_data write_data;
+    struct i2c_read_data read_data;
+    enum i2c_state i2c_state;
+    enum measurements_state measurements_state;
+    const struct bmp180_step *step;
+    uint8_t steps;
+    enum step_state step_state;
+    struct bmp180_step transfer;
+    uint8_t index;
+    uint8_t retries;
+    uint8_t image[BMP180_IMAGE_LENGTH];
+    uint8_t waiting;
+    uint8_t polled;
+    uint32_t conversion_start;
+};
+
+/*
+ * Initialises the context so that the calibration data is read on the first
+ * measurements
+ */
+void bmp180_init(struct bmp180_context *context);
+
+/*
+ * Sets the oversampling mode of the next measurements. A value above
+ * BMP180_ULTRA_HIGH_RESOLUTION selects it.
+ */
+void bmp180_set_mode(struct bmp180_context *context, enum bmp180_mode mode);
+
+/*
+ * Sets whether the end of conversion is detected by polling the control
+ * register instead of waiting the full conversion time
+ */
+void bmp180_set_eoc_polling(struct bmp180_context *context, uint8_t enabled);
+
+/*
+ * Sets how long UT is reused for: up to the given number of pressure-only
+ * measurements in a row (0 measures UT every time), and up to the given
+ * number of milliseconds
+ */
+void bmp180_set_streaming(struct bmp180_context *context, uint8_t samples, uint16_t ms);
+
+/*
+ * Prepares the context for a new set of measurements
+ */
+void bmp180_start(struct bmp180_context *context, struct bmp180_measurements *measurements);
+
+/*
+ * Advances the measurements without waiting for the sensor to convert.
+ * Returns BMP180_ERROR once the bus has failed more than BMP180_RETRIES
+ * times.
  */
-void bmp180_measure(struct bmp180_measurements *measurements);
+enum bmp180_status bmp180_poll(struct bmp180_context *context);
+
+/*
+ * Returns non-zero once the conversion started by the last command has had
+ * the given number of milliseconds to complete, and one more tick. It notes
+ * the start in start on the first call while not waiting, and clears waiting
+ * once the time has passed.
+ */
+uint8_t bmp180_conversion_elapsed(uint8_t *waiting, uint32_t *start, uint8_t ms);
+
+/*
+ * Returns the given oversampling mode, or BMP180_ULTRA_HIGH_RESOLUTION for a
+ * value above it
+ */
+enum bmp180_mode bmp180_clamp_mode(enum bmp180_mode mode);
+
+/*
+ * Calculates the temperature and pressure from the completed measurements
+ */
+void bmp180_complete(struct bmp180_context *context);
+
+/*
+ * Calculates the temperature and pressure of the given measurements with the
+ * calibration data of the context, reusing B5 while UT is unchanged
+ */
+void bmp180_compensate(struct bmp180_context *context, struct bmp180_measurements *measurements);
+
+/*
+ * Starts the BMP180 measurements and waits for them to complete or fail
+ */
+enum bmp180_status bmp180_measure(struct bmp180_measurements *measurements);
+
+/*
+ * Returns the calibration word at the given byte offset from register 0xAA,
+ * from wherever the source holds the registers read
+ */
+typedef uint16_t (*bmp180_word_getter)(const void *source, uint8_t offset);
+
+/*
+ * Decodes the calibration data from the registers read into the source
+ */
+void bmp180_decode_calibration(struct bmp180_calibration *calibration, bmp180_word_getter word, const void *source);
 
 /*
  * Calculate the temperature and pressure
  */
-void bmp180_calculate(struct bmp180_measurements *measurements);
+void bmp180_calculate(struct bmp180_calibration *calibration, struct bmp180_measurements *measurements);
+
+/*
+ * Calculates the B5 term of the temperature from UT
+ */
+int32_t bmp180_calculate_b5(const struct bmp180_calibration *calibration, int32_t ut);
 
 /*
- * Delays processing by specified milliseconds
+ * Calculates the temperature from B5, and the pressure from B5 and UP
  */
-void delay_ms(uint16_t);
+void bmp180_calculate_pressure(const struct bmp180_calibration *calibration, int32_t b5, struct bmp180_measurements *measurements);
 
 #endif
@@ -0,0 +1,279 @@
+#include "bmp180_lanes.h"
+#include "timer.h"
+
+#ifdef I2C_LANES
+
+/*
+ * Registers read from a lane for the measurements: the chip ID, UT or UP
+ */
+#define LANE_REGISTERS 3
+
+/*
+ * The calibration data of a lane is read into its struct bmp180_calibration,
+ * then decoded in place, so the registers must fill it exactly
+ */
+_Static_assert(sizeof(struct bmp180_calibration) == BMP180_CALIBRATION_LENGTH,
+	"struct bmp180_calibration must hold the calibration registers");
+
+/*
+ * Writes the same byte to each of the given lanes. Returns the lanes that
+ * acknowledged.
+ */
+static uint8_t lanes_write_byte(uint8_t lanes, uint8_t byte)
+{
+    uint8_t bytes[I2C_LANE_COUNT];
+
+    for (uint8_t lane = 0; lane < I2C_LANE_COUNT; lane++) {
+	bytes[lane] = byte;
+    }
+    return i2c_lanes_write(lanes, bytes);
+}
+
+/*
+ * Writes a value to a register on each of the given lanes, once. Returns the
+ * lanes that acknowledged every byte.
+ */
+static uint8_t lanes_write_once(uint8_t lanes, uint8_t reg, uint8_t value)
+{
+    i2c_lanes_start(lanes);
+    lanes &= lanes_write_byte(lanes, BMP180_WRITE);
+    lanes &= lanes_write_byte(lanes, reg);
+    lanes &= lanes_write_byte(lanes, value);
+    i2c_lanes_stop(I2C_LANES_ALL);
+    return lanes;
+}
+
+/*
+ * Reads length registers from reg on each of the given lanes, once, into
+ * data[lane * stride + byte], leaving the bytes of the other lanes alone.
+ * Returns the lanes that acknowledged every byte and were read without a
+ * clock stretched too long.
+ */
+static uint8_t lanes_read_once(uint8_t lanes, uint8_t reg, uint8_t *data, uint8_t stride, uint8_t length)
+{
+    uint8_t bytes[I2C_LANE_COUNT];
+    uint8_t acked = lanes;
+
+    i2c_lanes_start(acked);
+    acked &= lanes_write_byte(acked, BMP180_WRITE);
+    acked &= lanes_write_byte(acked, reg);
+    i2c_lanes_start(acked);
+    acked &= lanes_write_byte(acked, BMP180_READ);
+    for (uint8_t i = 0; i < length; i++) {
+	acked &= i2c_lanes_read(acked, bytes, i == length - 1);
+	for (uint8_t lane = 0; lane < I2C_LANE_COUNT; lane++) {
+	    if (lanes & (1 << lane)) {
+		data[lane * stride + i] = bytes[lane];
+	    }
+	}
+    }
+    i2c_lanes_stop(I2C_LANES_ALL);
+    return acked;
+}
+
+/*
+ * Frees the bus after a transfer that failed on some of the given lanes.
+ * Returns non-zero if the transfer may be repeated, until the retries run
+ * out.
+ */
+static uint8_t lanes_retry(struct bmp180_lanes *lanes, uint8_t active)
+{
+    i2c_lanes_recover(active);
+    if (lanes->retries == 0) {
+	return 0;
+    }
+    lanes->retries--;
+    return 1;
+}
+
+/*
+ * Writes a value to a register on each of the given lanes, repeating the
+ * write on all of them while some fail. Returns the lanes that acknowledged
+ * every byte of the last write.
+ */
+static uint8_t lanes_write(struct bmp180_lanes *lanes, uint8_t active, uint8_t reg, uint8_t value)
+{
+    uint8_t acked = lanes_write_once(active, reg, value);
+
+    while (acked != active && lanes_retry(lanes, active)) {
+	acked = lanes_write_once(active, reg, value);
+    }
+    return acked;
+}
+
+/*
+ * Reads registers on each of the given lanes as lanes_read_once(), repeating
+ * the read on all of them while some fail, so that data holds a single read
+ */
+static uint8_t lanes_read(struct bmp180_lanes *lanes, uint8_t active, uint8_t reg, uint8_t *data, uint8_t stride, uint8_t length)
+{
+    uint8_t acked = lanes_read_once(active, reg, data, stride, length);
+
+    while (acked != active && lanes_retry(lanes, active)) {
+	acked = lanes_read_once(active, reg, data, stride, length);
+    }
+    return acked;
+}
+
+/*
+ * Returns a big-endian word from the registers read, for
+ * bmp180_decode_calibration(). Each word is read before it is decoded over
+ * the same two bytes, so a lane's calibration is decoded in place.
+ */
+static uint16_t lane_word(const void *registers, uint8_t offset)
+{
+    const uint8_t *bytes = (const uint8_t *) registers + offset;
+
+    return (uint16_t) bytes[0] << 8 | bytes[1];
+}
+
+/*
+ * Initialises the context so that the sensors are looked for on the first
+ * measurements
+ */
+void bmp180_lanes_init(struct bmp180_lanes *lanes)
+{
+    lanes->found = 0;
+    lanes->calibrated = 0;
+    lanes->identify = 0;
+    lanes->mode = BMP180_OSS;
+}
+
+/*
+ * Sets the oversampling mode of the next measurements, the highest for a
+ * value out of range
+ */
+void bmp180_lanes_set_mode(struct bmp180_lanes *lanes, enum bmp180_mode mode)
+{
+    lanes->mode = bmp180_clamp_mode(mode);
+}
+
+/*
+ * Prepares the context for a new set of measurements, looking for the
+ * missing sensors every BMP180_LANES_IDENTIFY_SAMPLES sets
+ */
+void bmp180_lanes_start(struct bmp180_lanes *lanes, struct bmp180_measurements *measurements)
+{
+    lanes->measurements = measurements;
+    lanes->waiting = 0;
+    lanes->retries = BMP180_RETRIES;
+    if (lanes->found != I2C_LANES_ALL && lanes->identify-- == 0) {
+	lanes->identify = BMP180_LANES_IDENTIFY_SAMPLES - 1;
+	lanes->state = L_IDENTIFY;
+    } else {
+	lanes->state = L_TEMPERATURE;
+    }
+}
+
+/*
+ * Advances the measurements on every lane at once
+ */
+enum bmp180_status bmp180_lanes_poll(struct bmp180_lanes *lanes)
+{
+    uint8_t data[I2C_LANE_COUNT][LANE_REGISTERS];
+    struct bmp180_measurements *measurements = lanes->measurements;
+
+    while (lanes->state != L_DONE) {
+	switch (lanes->state) {
+	    case L_IDENTIFY:
+		/*
+		 * Only the missing sensors are looked for, and a lane without
+		 * one does not acknowledge, which is not worth a retry. Until
+		 * the measurements, active holds the lanes that answer.
+		 */
+		lanes->active = lanes_read_once(I2C_LANES_ALL & ~lanes->found, 0xD0, data[0], LANE_REGISTERS, 1);
+		for (uint8_t lane = 0; lane < I2C_LANE_COUNT; lane++) {
+		    if ((lanes->active & (1 << lane)) && data[lane][0] != BMP180_CHIP_ID) {
+			lanes->active &= ~(1 << lane);
+		    }
+		}
+		lanes->found |= lanes->active;
+		lanes->state = lanes->active ? L_CALIBRATE : L_TEMPERATURE;
+		break;
+
+	    case L_CALIBRATE:
+		/*
+		 * Each sensor has its own calibration data, and the chip ID
+		 * is the same for all of them, so it is not kept in EEPROM.
+		 * The registers are read straight into the calibration of
+		 * each lane, which is not calibrated until it is decoded.
+		 */
+		lanes->active = lanes_read(lanes, lanes->found & ~lanes->calibrated, 0xAA,
+			(uint8_t *) lanes->calibration, BMP180_CALIBRATION_LENGTH, BMP180_CALIBRATION_LENGTH);
+		for (uint8_t lane = 0; lane < I2C_LANE_COUNT; lane++) {
+		    if (lanes->active & (1 << lane)) {
+			bmp180_decode_calibration(&lanes->calibration[lane], lane_word, &lanes->calibration[lane]);
+		    }
+		}
+		lanes->calibrated |= lanes->active;
+		lanes->state = L_TEMPERATURE;
+		break;
+
+	    case L_TEMPERATURE:
+		if (!lanes->calibrated) {
+		    lanes->active = 0;
+		    lanes->state = L_DONE;
+		    break;
+		}
+		lanes->active = lanes_write(lanes, lanes->calibrated, 0xF4, 0x2E);
+		lanes->delay = 5;
+		lanes->state = L_UT;
+		break;
+
+	    case L_UT:
+		if (!bmp180_conversion_elapsed(&lanes->waiting, &lanes->conversion_start, lanes->delay)) {
+		    return BMP180_BUSY;
+		}
+		lanes->active = lanes_read(lanes, lanes->active, 0xF6, data[0], LANE_REGISTERS, 2);
+		for (uint8_t lane = 0; lane < I2C_LANE_COUNT; lane++) {
+		    measurements[lane].ut = lane_word(data[lane], 0);
+		}
+		lanes->state = L_PRESSURE;
+		break;
+
+	    case L_PRESSURE:
+		lanes->active = lanes_write(lanes, lanes->active, 0xF4, 0x34 | lanes->mode << 6);
+		lanes->delay = bmp180_conversion_times[lanes->mode];
+		lanes->state = L_UP;
+		break;
+
+	    case L_UP:
+		if (!bmp180_conversion_elapsed(&lanes->waiting, &lanes->conversion_start, lanes->delay)) {
+		    return BMP180_BUSY;
+		}
+		lanes->active = lanes_read(lanes, lanes->active, 0xF6, data[0], LANE_REGISTERS, 3);
+		for (uint8_t lane = 0; lane < I2C_LANE_COUNT; lane++) {
+		    measurements[lane].oss = lanes->mode;
+		    measurements[lane].up = ((int32_t) data[lane][0] << 16 | (int32_t) data[lane][1] << 8 | data[lane][2]) >> (8 - lanes->mode);
+		}
+		lanes->state = L_DONE;
+		break;
+
+	    default:
+		break;
+	}
+    }
+
+    /*
+     * The lanes that failed are missing sensors until looked for again
+     */
+    lanes->found = lanes->calibrated = lanes->active;
+
+    return lanes->active ? BMP180_READY : BMP180_ERROR;
+}
+
+/*
+ * Calculates the temperature and pressure of every lane that completed the
+ * measurements
+ */
+uint8_t bmp180_lanes_complete(struct bmp180_lanes *lanes)
+{
+    for (uint8_t lane = 0; lane < I2C_LANE_COUNT; lane++) {
+	if (lanes->active & (1 << lane)) {
+	    bmp180_calculate(&lanes->calibration[lane], &lanes->measurements[lane]);
+	}
+    }
+    return lanes->active;
+}
+
+#endif
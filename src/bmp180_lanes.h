@@ -0,0 +1,88 @@
+#include "hal.h"
+#include <stdint.h>
+
+#ifndef BMP180_LANES_H
+#define BMP180_LANES_H
+
+#include "bmp180.h"
+#include "i2c.h"
+
+/*
+ * Several BMP180s, one on each lane of the multi-lane I2C (see I2C_LANES in
+ * i2c.h), measured at once. They all receive the same commands, so the bus
+ * time of a set of measurements is the same as for one sensor.
+ */
+
+#ifdef I2C_LANES
+
+/*
+ * Number of sets of measurements between looks for the sensors of lanes that
+ * have none, whether never found or dropped after failing, from 1 to 256
+ */
+#ifndef BMP180_LANES_IDENTIFY_SAMPLES
+#define BMP180_LANES_IDENTIFY_SAMPLES 64
+#endif
+
+/*
+ * Represents the state of the measurements on the lanes
+ */
+enum bmp180_lanes_state { L_IDENTIFY, L_CALIBRATE, L_TEMPERATURE, L_UT, L_PRESSURE, L_UP, L_DONE };
+
+/*
+ * Represents the context data of the measurements on the lanes. The lanes
+ * masks hold a bit per lane: the sensors found, calibrated, and still
+ * responding in the measurements in progress. The retries left are shared by
+ * the lanes, as BMP180_RETRIES in bmp180.h, and identify counts down the
+ * sets of measurements to the next look for the missing sensors.
+ */
+struct bmp180_lanes {
+    uint8_t found;
+    uint8_t calibrated;
+    uint8_t active;
+    uint8_t retries;
+    uint8_t identify;
+    enum bmp180_mode mode;
+    enum bmp180_lanes_state state;
+    uint8_t waiting;
+    uint8_t delay;
+    uint32_t conversion_start;
+    struct bmp180_calibration calibration[I2C_LANE_COUNT];
+    struct bmp180_measurements *measurements;
+};
+
+/*
+ * Initialises the context so that the sensors are looked for and their
+ * calibration data read on the first measurements
+ */
+void bmp180_lanes_init(struct bmp180_lanes *lanes);
+
+/*
+ * Sets the oversampling mode of the next measurements. A value above
+ * BMP180_ULTRA_HIGH_RESOLUTION selects it.
+ */
+void bmp180_lanes_set_mode(struct bmp180_lanes *lanes, enum bmp180_mode mode);
+
+/*
+ * Prepares the context for a new set of measurements into measurements[n]
+ * for each lane n
+ */
+void bmp180_lanes_start(struct bmp180_lanes *lanes, struct bmp180_measurements *measurements);
+
+/*
+ * Advances the measurements without waiting for the sensors to convert. A
+ * transfer that fails on some of its lanes frees the bus and is repeated on
+ * all of them, and the lanes that still fail once the retries run out drop
+ * out of the measurements. They are looked for again as missing sensors, so a
+ * replaced sensor is calibrated afresh.
+ */
+enum bmp180_status bmp180_lanes_poll(struct bmp180_lanes *lanes);
+
+/*
+ * Calculates the temperature and pressure of every lane that completed the
+ * measurements. Returns those lanes.
+ */
+uint8_t bmp180_lanes_complete(struct bmp180_lanes *lanes);
+
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+#include "filter.h"
+
+/*
+ * Divides by 2^shift, rounding to the nearest integer
+ */
+static int32_t filter_scale(int32_t value, uint8_t shift)
+{
+    if (shift == 0) {
+	return value;
+    }
+    return (value + ((int32_t) 1 << (shift - 1))) >> shift;
+}
+
+/*
+ * Initialises the filter with the given mode and shift
+ */
+void filter_init(struct filter *filter, enum filter_mode mode, uint8_t shift)
+{
+    filter->mode = mode;
+    filter->shift = shift;
+    filter->count = 0;
+    filter->temperature_sum = 0;
+    filter->pressure_sum = 0;
+}
+
+/*
+ * Passes the temperature and pressure of the measurements through the filter
+ */
+uint8_t filter_update(struct filter *filter, struct bmp180_measurements *measurements)
+{
+    switch (filter->mode) {
+	case FILTER_AVERAGE:
+	    filter->temperature_sum += measurements->temperature;
+	    filter->pressure_sum += measurements->pressure;
+
+	    /*
+	     * Only output once every 2^shift samples
+	     */
+	    if (++filter->count < ((uint16_t) 1 << filter->shift)) {
+		return 0;
+	    }
+
+	    measurements->temperature = filter_scale(filter->temperature_sum, filter->shift);
+	    measurements->pressure = filter_scale(filter->pressure_sum, filter->shift);
+	    filter->count = 0;
+	    filter->temperature_sum = 0;
+	    filter->pressure_sum = 0;
+	    return 1;
+
+	case FILTER_IIR:
+	    /*
+	     * Start from the first sample rather than from zero, then move
+	     * 1/2^shift of the way towards each new sample:
+	     * sum = sum - sum / 2^shift + sample
+	     */
+	    if (!filter->count) {
+		filter->count = 1;
+		filter->temperature_sum = measurements->temperature * ((int32_t) 1 << filter->shift);
+		filter->pressure_sum = measurements->pressure * ((int32_t) 1 << filter->shift);
+	    } else {
+		filter->temperature_sum += measurements->temperature - (filter->temperature_sum >> filter->shift);
+		filter->pressure_sum += measurements->pressure - (filter->pressure_sum >> filter->shift);
+	    }
+
+	    measurements->temperature = filter_scale(filter->temperature_sum, filter->shift);
+	    measurements->pressure = filter_scale(filter->pressure_sum, filter->shift);
+	    return 1;
+
+	default:
+	    return 1;
+    }
+}
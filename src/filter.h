@@ -0,0 +1,61 @@
+#include <stdint.h>
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "bmp180.h"
+
+/*
+ * Default filter mode and shift, see enum filter_mode
+ */
+#ifndef FILTER_MODE
+#define FILTER_MODE FILTER_NONE
+#endif
+
+#ifndef FILTER_SHIFT
+#define FILTER_SHIFT 2
+#endif
+
+/*
+ * Largest shift: 2^12 pressures of up to 110 kPa still fit in the 32-bit sums
+ */
+#define FILTER_SHIFT_MAX 12
+
+#if FILTER_SHIFT > FILTER_SHIFT_MAX
+#error "FILTER_SHIFT must be at most 12"
+#endif
+
+/*
+ * Represents the filter modes:
+ * - FILTER_NONE passes every sample through
+ * - FILTER_AVERAGE outputs the mean of every 2^shift samples
+ * - FILTER_IIR outputs every sample through a first-order low-pass filter
+ *   with a coefficient of 1/2^shift
+ */
+enum filter_mode { FILTER_NONE, FILTER_AVERAGE, FILTER_IIR };
+
+/*
+ * Represents the state of the filter. The sums hold the running totals when
+ * averaging, and the filter outputs scaled by 2^shift for the IIR filter.
+ */
+struct filter {
+    enum filter_mode mode;
+    uint8_t shift;
+    uint16_t count;
+    int32_t temperature_sum;
+    int32_t pressure_sum;
+};
+
+/*
+ * Initialises the filter with the given mode and shift (at most FILTER_SHIFT_MAX)
+ */
+void filter_init(struct filter *filter, enum filter_mode mode, uint8_t shift);
+
+/*
+ * Passes the temperature and pressure of the measurements through the filter.
+ * Returns non-zero, with the measurements replaced by the filter output, when
+ * there is an output for this sample.
+ */
+uint8_t filter_update(struct filter *filter, struct bmp180_measurements *measurements);
+
+#endif
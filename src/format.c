@@ -0,0 +1,62 @@
+#include "format.h"
+#include "hal.h"
+#include "usi.h"
+
+/*
+ * Powers of ten that fit in 32 bits, largest first
+ */
+static const uint32_t powers_of_ten[] PROGMEM = {
+    1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL, 10000UL, 1000UL, 100UL, 10UL, 1UL
+};
+
+#define DIGITS (sizeof(powers_of_ten) / sizeof(powers_of_ten[0]))
+
+/*
+ * Sends a signed 32-bit value in decimal
+ */
+void format_int32(int32_t value)
+{
+    format_fixed(value, 0);
+}
+
+/*
+ * Sends a signed fixed-point value in decimal with the given number of
+ * decimal places
+ */
+void format_fixed(int32_t value, uint8_t decimals)
+{
+    uint32_t magnitude = value;
+    uint8_t point = DIGITS - decimals;
+    uint8_t started = 0;
+
+    if (value < 0) {
+	usi_send_byte('-');
+	magnitude = -magnitude;
+    }
+
+    for (uint8_t i = 0; i < DIGITS; i++) {
+	uint32_t power = pgm_read_dword(&powers_of_ten[i]);
+	char digit = '0';
+
+	/*
+	 * Count how many times the power of ten can be subtracted
+	 */
+	while (magnitude >= power) {
+	    magnitude -= power;
+	    digit++;
+	}
+
+	/*
+	 * Skip leading zeros, but keep at least one digit before the point
+	 */
+	if (digit != '0' || i + 1 >= point) {
+	    started = 1;
+	}
+	if (i == point) {
+	    usi_send_byte('.');
+	}
+	if (started) {
+	    usi_send_byte(digit);
+	}
+    }
+}
@@ -0,0 +1,17 @@
+#include <stdint.h>
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+/*
+ * Sends a signed 32-bit value in decimal
+ */
+void format_int32(int32_t value);
+
+/*
+ * Sends a signed fixed-point value in decimal with the given number of
+ * decimal places, e.g. 150 with 1 decimal place is sent as "15.0"
+ */
+void format_fixed(int32_t value, uint8_t decimals);
+
+#endif
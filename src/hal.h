@@ -0,0 +1,63 @@
+#ifndef HAL_H
+#define HAL_H
+
+/*
+ * Hardware abstraction for the parts of the driver that can also be built on
+ * a host against the simulation in host/. The I2C lines are open-drain: a
+ * line is pulled LOW by setting its data direction bit, and released to be
+ * pulled HIGH by clearing it.
+ */
+
+#ifdef __AVR__
+
+#include <avr/eeprom.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+#include <util/delay.h>
+
+#ifndef I2C
+#define I2C DDRC
+#endif
+
+#ifndef I2C_READ
+#define I2C_READ PINC
+#endif
+
+#ifndef SCL
+#define SCL PC5
+#endif
+
+#ifndef SDA
+#define SDA PC4
+#endif
+
+#define HAL_SCL_LOW()     (I2C |= (1 << SCL))
+#define HAL_SCL_RELEASE() (I2C &= ~(1 << SCL))
+#define HAL_SDA_LOW()     (I2C |= (1 << SDA))
+#define HAL_SDA_RELEASE() (I2C &= ~(1 << SDA))
+#define HAL_SDA_READ()    (I2C_READ & (1 << SDA))
+#define HAL_SCL_READ()    (I2C_READ & (1 << SCL))
+
+/*
+ * Pulls LOW the SDA lines of the given pins that are set in low, and releases
+ * the others, in one port write
+ */
+#define HAL_SDA_LANES(pins, low) (I2C = (I2C & ~(pins)) | (low))
+#define HAL_SDA_LANES_READ()     (I2C_READ)
+
+#define HAL_DELAY_CYCLES(cycles) __builtin_avr_delay_cycles(cycles)
+
+/*
+ * Marks code that takes about the given number of cycles, for the host to
+ * charge to the simulated time
+ */
+#define HAL_CODE_CYCLES(cycles) ((void) 0)
+
+#else
+
+#include "hal_host.h"
+
+#endif
+
+#endif
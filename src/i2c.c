@@ -1,34 +1,67 @@
-#include <avr/io.h>
-#include <util/delay.h>
-
+#include "hal.h"
 #include "i2c.h"
+#include "profile.h"
 
-#ifndef I2C
-#define I2C DDRC
+#ifndef F_CPU
+#define F_CPU 1000000UL
 #endif
 
-#ifndef I2C_READ
-#define I2C_READ PINC
+/*
+ * Estimated cycles spent between the delays of the SCL low and high periods:
+ * setting SDA in the low period, and returning to the caller and dispatching
+ * the next bit in the high period. They count towards each period, so the
+ * delays of the periods where that code runs are shortened by as much.
+ */
+#ifndef I2C_LOW_OVERHEAD_CYCLES
+#define I2C_LOW_OVERHEAD_CYCLES 4
 #endif
 
-#ifndef SCL
-#define SCL PC5
+#ifndef I2C_HIGH_OVERHEAD_CYCLES
+#define I2C_HIGH_OVERHEAD_CYCLES 24
 #endif
 
-#ifndef SDA
-#define SDA PC4
-#endif
+/*
+ * Each period lasts half a clock cycle, but no less than the minimum of the
+ * mode. Below about 20 cycles per period the overhead alone exceeds it, and
+ * the bus runs as fast as the code can toggle it.
+ */
+#define HALF_CYCLES        (F_CPU / (2 * I2C_CLOCK))
+#define NS_CYCLES(ns)      ((F_CPU / 1000 * (ns) + 999999UL) / 1000000UL)
+#define PERIOD_CYCLES(ns)  (HALF_CYCLES > NS_CYCLES(ns) ? HALF_CYCLES : NS_CYCLES(ns))
+#define DELAY_CYCLES(ns, overhead) (PERIOD_CYCLES(ns) > (overhead) ? PERIOD_CYCLES(ns) - (overhead) : 0)
 
-#ifndef F_CPU
-#define F_CPU 1000000UL
-#endif
+#define HOLD_LOW  HAL_DELAY_CYCLES(DELAY_CYCLES(I2C_T_LOW_NS, I2C_LOW_OVERHEAD_CYCLES));
+#define HOLD_HIGH HAL_DELAY_CYCLES(DELAY_CYCLES(I2C_T_HIGH_NS, I2C_HIGH_OVERHEAD_CYCLES));
 
-#ifndef BAUD_RATE
-#define BAUD_RATE 200000UL
-#endif
+/*
+ * The whole period, for where nothing runs between the two edges: the START
+ * hold time, the high period of ACKM and the STOP setup time among others
+ */
+#define HOLD_LOW_FULL  HAL_DELAY_CYCLES(PERIOD_CYCLES(I2C_T_LOW_NS));
+#define HOLD_HIGH_FULL HAL_DELAY_CYCLES(PERIOD_CYCLES(I2C_T_HIGH_NS));
+
+/*
+ * Marks the code the shortened periods count on
+ */
+#define LOW_OVERHEAD  HAL_CODE_CYCLES(I2C_LOW_OVERHEAD_CYCLES);
+#define HIGH_OVERHEAD HAL_CODE_CYCLES(I2C_HIGH_OVERHEAD_CYCLES);
+
+/*
+ * Releases SCL and waits, for a bounded time, for a slave stretching the
+ * clock to release it too. Returns zero if it is still held LOW.
+ */
+static uint8_t scl_release(void)
+{
+    uint8_t polls = I2C_STRETCH_LIMIT;
 
-#define PERIOD_TICKS (F_CPU/BAUD_RATE)
-#define HOLD _delay_us(PERIOD_TICKS);
+    HAL_SCL_RELEASE();
+    while (!HAL_SCL_READ()) {
+	if (polls-- == 0) {
+	    return 0;
+	}
+    }
+    return 1;
+}
 
 /*
  * Initialises the I2C
@@ -36,11 +69,16 @@
 void i2c_init()
 {
     /*
-     * Set SCL and SDA pins to open-drain
+     * Set SCL and SDA pins to open-drain, ending with a STOP
      */
-    I2C &= ~(1 << SCL) & ~(1 << SDA);
-    I2C |=  (1 << SCL) |  (1 << SDA);
-    I2C &= ~(1 << SCL) & ~(1 << SDA);
+    HAL_SCL_RELEASE();
+    HAL_SDA_RELEASE();
+    HAL_SCL_LOW();
+    HAL_SDA_LOW();
+    HOLD_LOW_FULL
+    HAL_SCL_RELEASE();
+    HOLD_HIGH_FULL
+    HAL_SDA_RELEASE();
 }
 
 /*
@@ -51,14 +89,19 @@ void i2c_start()
     /*
      * If this tick is missing, things break!
      */
-    I2C |= (1 << SCL);
-    HOLD
-    I2C &= ~(1 << SCL);
-    HOLD
+    HAL_SCL_LOW();
+    HOLD_LOW_FULL
+    HAL_SCL_RELEASE();
 
-    I2C |= (1 << SDA);
-    I2C |= (1 << SCL);
-    HOLD
+    /*
+     * The START setup time is as long as the low period in standard mode
+     */
+    HOLD_LOW_FULL
+
+    HAL_SDA_LOW();
+    HOLD_HIGH_FULL
+    HAL_SCL_LOW();
+    HOLD_LOW
 }
 
 /*
@@ -66,12 +109,16 @@ void i2c_start()
  */
 uint8_t i2c_ack()
 {
-    I2C |= (1 << SCL);
-    HOLD
-    I2C &= ~(1 << SDA);
-    I2C &= ~(1 << SCL);
-    HOLD
-    return (I2C_READ & (1 << SDA)) == 0;
+    HAL_SCL_LOW();
+    HOLD_LOW
+    HAL_SDA_RELEASE();
+    LOW_OVERHEAD
+    if (!scl_release()) {
+	return 0;
+    }
+    HOLD_HIGH
+    HIGH_OVERHEAD
+    return HAL_SDA_READ() == 0;
 }
 
 /*
@@ -79,11 +126,19 @@ uint8_t i2c_ack()
  */
 void i2c_ackm()
 {
-    I2C |= (1 << SCL);
-    HOLD
-    I2C |= (1 << SDA);
-    I2C &= ~(1 << SCL);
-    HOLD
+    HAL_SCL_LOW();
+    HOLD_LOW
+    HAL_SDA_LOW();
+    LOW_OVERHEAD
+    HAL_SCL_RELEASE();
+    HOLD_HIGH_FULL
+
+    /*
+     * Release SDA only after SCL is low again, otherwise the slave sees a
+     * STOP before the next byte of a burst read.
+     */
+    HAL_SCL_LOW();
+    HAL_SDA_RELEASE();
 }
 
 /*
@@ -91,11 +146,13 @@ void i2c_ackm()
  */
 void i2c_nackm()
 {
-    I2C |= (1 << SCL);
-    HOLD
-    I2C &= ~(1 << SDA);
-    I2C &= ~(1 << SCL);
-    HOLD
+    HAL_SCL_LOW();
+    HOLD_LOW
+    HAL_SDA_RELEASE();
+    LOW_OVERHEAD
+    HAL_SCL_RELEASE();
+    HOLD_HIGH
+    HIGH_OVERHEAD
 }
 
 /*
@@ -103,14 +160,36 @@ void i2c_nackm()
  */
 void i2c_stop()
 {
-    I2C &= ~(1 << SCL);
-    HOLD
-    I2C |= (1 << SCL);
-    HOLD
-    I2C |= (1 << SDA);
-    I2C &= ~(1 << SCL);
-    HOLD
-    I2C &= ~(1 << SDA);
+    HAL_SCL_RELEASE();
+    HOLD_HIGH_FULL
+    HAL_SCL_LOW();
+    HOLD_LOW
+    HAL_SDA_LOW();
+    LOW_OVERHEAD
+    HAL_SCL_RELEASE();
+    HOLD_HIGH_FULL
+    HAL_SDA_RELEASE();
+}
+
+/*
+ * Frees the bus from a slave holding SDA LOW, then stops
+ */
+uint8_t i2c_recover()
+{
+    /*
+     * A slave left in the middle of a read lets go of SDA at the latest
+     * when it sees the missing acknowledge after the 8 data bits
+     */
+    HAL_SDA_RELEASE();
+    for (uint8_t i = 0; i < 9 && !HAL_SDA_READ(); i++) {
+	HAL_SCL_LOW();
+	HOLD_LOW_FULL
+	scl_release();
+	HOLD_HIGH_FULL
+    }
+
+    i2c_stop();
+    return HAL_SDA_READ() && HAL_SCL_READ();
 }
 
 /*
@@ -123,33 +202,48 @@ void i2c_write(struct i2c_write_data *data, enum i2c_state *state)
 	    break;
 
 	case W_WRITE:
-	    I2C |= (1 << SCL);
-	    HOLD
+	    HAL_SCL_LOW();
+	    HOLD_LOW
 	    if (data->byte & 0x80) {
-		I2C &= ~(1 << SDA);
+		HAL_SDA_RELEASE();
 	    } else {
-		I2C |= (1 << SDA);
+		HAL_SDA_LOW();
+	    }
+	    LOW_OVERHEAD
+	    if (!scl_release()) {
+		data->state = W_ERROR;
+		break;
 	    }
-	    I2C &= ~(1 << SCL);
-	    HOLD
+	    HOLD_HIGH
 
+	    /*
+	     * The acknowledge is clocked on the next call, so that every high
+	     * period ends with the return and dispatch
+	     */
 	    data->byte <<= 1;
-
 	    if (--data->bit_counter == 0) {
-		if (i2c_ack()) {
-		    data->state = W_ACKS;
-		} else {
-		    data->state = W_ERROR;
-		}
+		data->state = W_ACK;
+	    }
+	    HIGH_OVERHEAD
+	    break;
+
+	case W_ACK:
+	    if (i2c_ack()) {
+		data->state = W_ACKS;
+	    } else {
+		data->state = W_ERROR;
 	    }
 	    break;
 
 	case W_ACKS:
+	    PROFILE_COUNT(PROFILE_BYTES);
 	    data->state = W_NONE;
 	    *state = data->success_state;
 	    break;
 
 	case W_ERROR:
+	    PROFILE_COUNT(PROFILE_BYTES);
+	    PROFILE_COUNT(PROFILE_NAKS);
 	    data->state = W_NONE;
 	    *state = data->error_state;
 	    break;
@@ -166,7 +260,7 @@ void i2c_read(struct i2c_read_data *data, enum i2c_state *state)
 	    break;
 
 	case R_READ:
-	    I2C &= ~(1 << SDA);
+	    HAL_SDA_RELEASE();
 	    data->byte = 0;
 	    data->state = R_READING;
 	    break;
@@ -174,12 +268,15 @@ void i2c_read(struct i2c_read_data *data, enum i2c_state *state)
 	case R_READING:
 	    data->byte <<= 1;
 
-	    I2C |= (1 << SCL);
-	    HOLD
-	    I2C &= ~(1 << SCL);
-	    HOLD
+	    HAL_SCL_LOW();
+	    HOLD_LOW_FULL
+	    if (!scl_release()) {
+		data->state = R_ERROR;
+		break;
+	    }
+	    HOLD_HIGH
 
-	    if (I2C_READ & (1 << SDA)) {
+	    if (HAL_SDA_READ()) {
 		data->byte |= 0x01;
 	    }
 
@@ -190,19 +287,27 @@ void i2c_read(struct i2c_read_data *data, enum i2c_state *state)
 		    data->state = R_ACKM;
 		}
 	    }
+	    HIGH_OVERHEAD
 	    break;
 
 	case R_NACKM:
+	    PROFILE_COUNT(PROFILE_BYTES);
 	    i2c_nackm();
 	    data->state = R_NONE;
 	    *state = data->success_state;
 	    break;
 
 	case R_ACKM:
+	    PROFILE_COUNT(PROFILE_BYTES);
 	    i2c_ackm();
 	    data->state = R_NONE;
 	    *state = data->success_state;
 	    break;
+
+	case R_ERROR:
+	    data->state = R_NONE;
+	    *state = data->error_state;
+	    break;
 	    
 	default:
 	    break;
@@ -211,3 +316,205 @@ void i2c_read(struct i2c_read_data *data, enum i2c_state *state)
 
 
 
+
+#ifdef I2C_LANES
+/*
+ * SCL is shared by every lane, the UART sends on PB1, and PB5 is RESET with
+ * the fuses of the Makefile
+ */
+#if defined(__AVR__) && ((I2C_LANES) & ((1 << PB1) | (1 << PB2) | (1 << PB5)))
+#error "I2C_LANES must not include PB1 (UART TX), PB2 (SCL) or PB5 (RESET)"
+#endif
+
+/*
+ * Returns the SDA pins of the given lanes
+ */
+static uint8_t lane_pins(uint8_t lanes)
+{
+    uint8_t pins = 0;
+
+    for (uint8_t pin = 1; pin; pin <<= 1) {
+	if ((I2C_LANES) & pin) {
+	    if (lanes & 1) {
+		pins |= pin;
+	    }
+	    lanes >>= 1;
+	}
+    }
+    return pins;
+}
+
+/*
+ * Returns the lanes of the given SDA pins
+ */
+static uint8_t pin_lanes(uint8_t pins)
+{
+    uint8_t lanes = 0;
+    uint8_t lane = 1;
+
+    for (uint8_t pin = 1; pin; pin <<= 1) {
+	if ((I2C_LANES) & pin) {
+	    if (pins & pin) {
+		lanes |= lane;
+	    }
+	    lane <<= 1;
+	}
+    }
+    return lanes;
+}
+
+/*
+ * Starts an I2C communication on the given lanes
+ */
+void i2c_lanes_start(uint8_t lanes)
+{
+    uint8_t pins = lane_pins(lanes);
+
+    HAL_SCL_LOW();
+    HOLD_LOW
+    HAL_SDA_LANES(pins, 0);
+    LOW_OVERHEAD
+    HAL_SCL_RELEASE();
+    HOLD_LOW_FULL
+
+    HAL_SDA_LANES(pins, pins);
+    HOLD_HIGH_FULL
+    HAL_SCL_LOW();
+    HOLD_LOW
+}
+
+/*
+ * Stops an I2C communication on the given lanes
+ */
+void i2c_lanes_stop(uint8_t lanes)
+{
+    uint8_t pins = lane_pins(lanes);
+
+    HAL_SCL_LOW();
+    HOLD_LOW
+    HAL_SDA_LANES(pins, pins);
+    LOW_OVERHEAD
+    HAL_SCL_RELEASE();
+    HOLD_HIGH_FULL
+    HAL_SDA_LANES(pins, 0);
+}
+
+/*
+ * Writes a byte to each of the given lanes at once
+ */
+uint8_t i2c_lanes_write(uint8_t lanes, const uint8_t *bytes)
+{
+    uint8_t pins = lane_pins(lanes);
+
+    for (uint8_t mask = 0x80; mask; mask >>= 1) {
+	/*
+	 * Gather the bit of every lane while SCL is still HIGH, then shift
+	 * them all out in one port write
+	 */
+	uint8_t low = 0;
+	uint8_t lane = 0;
+	for (uint8_t pin = 1; pin; pin <<= 1) {
+	    if ((I2C_LANES) & pin) {
+		if (!(bytes[lane++] & mask)) {
+		    low |= pin;
+		}
+	    }
+	}
+
+	HAL_SCL_LOW();
+	HOLD_LOW
+	HAL_SDA_LANES(pins, low & pins);
+	LOW_OVERHEAD
+	if (!scl_release()) {
+	    return 0;
+	}
+	HOLD_HIGH_FULL
+    }
+
+    /*
+     * Each slave acknowledges on its own lane
+     */
+    HAL_SCL_LOW();
+    HOLD_LOW
+    HAL_SDA_LANES(pins, 0);
+    LOW_OVERHEAD
+    if (!scl_release()) {
+	return 0;
+    }
+    HOLD_HIGH
+    HIGH_OVERHEAD
+    return pin_lanes(~HAL_SDA_LANES_READ() & pins);
+}
+
+/*
+ * Reads a byte from each of the given lanes at once
+ */
+uint8_t i2c_lanes_read(uint8_t lanes, uint8_t *bytes, uint8_t last)
+{
+    uint8_t pins = lane_pins(lanes);
+
+    HAL_SDA_LANES(pins, 0);
+    for (uint8_t lane = 0; lane < I2C_LANE_COUNT; lane++) {
+	bytes[lane] = 0;
+    }
+
+    for (uint8_t bit = 0; bit < 8; bit++) {
+	HAL_SCL_LOW();
+	HOLD_LOW_FULL
+	if (!scl_release()) {
+	    return 0;
+	}
+	HOLD_HIGH
+
+	/*
+	 * Sample every lane in one port read, then distribute the bits
+	 */
+	uint8_t in = HAL_SDA_LANES_READ();
+	uint8_t lane = 0;
+	for (uint8_t pin = 1; pin; pin <<= 1) {
+	    if ((I2C_LANES) & pin) {
+		bytes[lane] = bytes[lane] << 1 | ((in & pin) != 0);
+		lane++;
+	    }
+	}
+	HIGH_OVERHEAD
+    }
+
+    /*
+     * Acknowledge on every lane but the last byte, then release SDA only
+     * once SCL is LOW again, as i2c_ackm()
+     */
+    HAL_SCL_LOW();
+    HOLD_LOW
+    HAL_SDA_LANES(pins, last ? 0 : pins);
+    LOW_OVERHEAD
+    if (!scl_release()) {
+	return 0;
+    }
+    HOLD_HIGH_FULL
+    if (!last) {
+	HAL_SCL_LOW();
+	HAL_SDA_LANES(pins, 0);
+    }
+    return lanes;
+}
+
+/*
+ * Frees the given lanes from slaves holding SDA LOW, then stops
+ */
+uint8_t i2c_lanes_recover(uint8_t lanes)
+{
+    uint8_t pins = lane_pins(lanes);
+
+    HAL_SDA_LANES(pins, 0);
+    for (uint8_t i = 0; i < 9 && (HAL_SDA_LANES_READ() & pins) != pins; i++) {
+	HAL_SCL_LOW();
+	HOLD_LOW_FULL
+	scl_release();
+	HOLD_HIGH_FULL
+    }
+
+    i2c_lanes_stop(lanes);
+    return (HAL_SDA_LANES_READ() & pins) == pins && HAL_SCL_READ();
+}
+#endif
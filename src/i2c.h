@@ -1,20 +1,69 @@
+#include <stdint.h>
+
 #ifndef I2C_H
 #define I2C_H
 
-#ifndef I2C_STATE
-#define I2C_STATE \
-enum i2c_state { NONE, START, ADDRESS_WRITE, ADDRESS_READ, STOP };
+/*
+ * Default I2C clock in Hz: 100000 for standard mode or 400000 for fast mode
+ */
+#ifndef I2C_CLOCK
+#define I2C_CLOCK 100000UL
+#endif
+
+/*
+ * Minimum SCL low and high periods of the mode in ns. The START hold and STOP
+ * setup times are as long as the high period.
+ */
+#if I2C_CLOCK > 100000UL
+#define I2C_T_LOW_NS  1300
+#define I2C_T_HIGH_NS 600
+#else
+#define I2C_T_LOW_NS  4700
+#define I2C_T_HIGH_NS 4000
+#endif
+
+/*
+ * Default number of times SCL is polled for a slave stretching the clock
+ * before giving up on the transfer
+ */
+#ifndef I2C_STRETCH_LIMIT
+#define I2C_STRETCH_LIMIT 255
+#endif
+
+/*
+ * Pins the I2C backend uses on the I2C port, as a mask: the fixed pins of the
+ * USI in two-wire mode with I2C_BACKEND_USI, or else the bit-banged SCL and
+ * SDA of hal.h, and the lanes of the multi-lane mode
+ */
+#ifdef I2C_BACKEND_USI
+#define I2C_PINS ((1 << PB2) | (1 << PB0))
+#elif defined(I2C_LANES)
+#define I2C_PINS ((1 << SCL) | (1 << SDA) | (I2C_LANES))
+#else
+#define I2C_PINS ((1 << SCL) | (1 << SDA))
+#endif
+
+/*
+ * Multi-lane mode: I2C_LANES is a mask of pins of the I2C port, each the SDA
+ * line of its own bus sharing SCL. Lane n is the n-th pin set in the mask,
+ * and lanes are selected by masks of lane numbers.
+ */
+#ifdef I2C_LANES
+#define I2C_LANE_BIT(n)  (((I2C_LANES) >> (n)) & 1)
+#define I2C_LANE_COUNT   (I2C_LANE_BIT(0) + I2C_LANE_BIT(1) + I2C_LANE_BIT(2) + I2C_LANE_BIT(3) + \
+			  I2C_LANE_BIT(4) + I2C_LANE_BIT(5) + I2C_LANE_BIT(6) + I2C_LANE_BIT(7))
+#define I2C_LANES_ALL    ((1 << I2C_LANE_COUNT) - 1)
 #endif
 
 /*
  * Represents the state of the application
  */
-I2C_STATE
+enum i2c_state { NONE, START, ADDRESS_WRITE, REGISTER, DATA_WRITE, RESTART, ADDRESS_READ, DATA_READ, STOP, STOP_START, RECOVER };
 
 /*
  * Represents the state of the I2C write
  */
-enum i2c_write_state { W_NONE, W_WRITE, W_ACKS, W_ERROR };
+enum i2c_write_state { W_NONE, W_WRITE, W_ACK, W_ACKS, W_ERROR };
 
 /*
  * Represents the state of the I2C read
@@ -41,6 +90,7 @@ struct i2c_read_data {
     uint8_t send_nack;
     enum i2c_read_state state;
     enum i2c_state success_state;
+    enum i2c_state error_state;
 };
 
 /*
@@ -73,6 +123,12 @@ void i2c_nackm();
  */
 void i2c_stop();
 
+/*
+ * Frees the bus from a slave holding SDA LOW by clocking SCL until it lets
+ * go, at most 9 times, then stops. Returns non-zero if the bus is free.
+ */
+uint8_t i2c_recover();
+
 /*
  * Writes a byte to the I2C channel and updates the state of the application
  */
@@ -83,5 +139,36 @@ void i2c_write(struct i2c_write_data *data, enum i2c_state *state);
  */
 void i2c_read(struct i2c_read_data *data, enum i2c_state *state);
 
+#ifdef I2C_LANES
+/*
+ * Starts an I2C communication on the given lanes
+ */
+void i2c_lanes_start(uint8_t lanes);
+
+/*
+ * Stops an I2C communication on the given lanes
+ */
+void i2c_lanes_stop(uint8_t lanes);
+
+/*
+ * Writes bytes[n] to each lane n of the given lanes at once. Returns the
+ * lanes that acknowledged.
+ */
+uint8_t i2c_lanes_write(uint8_t lanes, const uint8_t *bytes);
+
+/*
+ * Reads a byte from each lane n of the given lanes into bytes[n] at once,
+ * acknowledging it unless it is the last. Returns the given lanes, or none if
+ * a slave held SCL LOW for too long.
+ */
+uint8_t i2c_lanes_read(uint8_t lanes, uint8_t *bytes, uint8_t last);
+
+/*
+ * Frees the given lanes from slaves holding SDA LOW, as i2c_recover(), then
+ * stops. Returns non-zero if the bus is free.
+ */
+uint8_t i2c_lanes_recover(uint8_t lanes);
+#endif
+
 #endif
 
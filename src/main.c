@@ -1,27 +1,242 @@
 #include <avr/io.h>
-#include <util/delay.h>
-#include <stdio.h>
+#include <avr/pgmspace.h>
 
+#include "altitude.h"
+#include "hal.h"
 #include "i2c.h"
 #include "usi.h"
 #include "bmp180.h"
+#include "bmp180_lanes.h"
+#include "filter.h"
+#include "format.h"
+#include "profile.h"
+#include "report.h"
+#include "scheduler.h"
+#include "store.h"
+#include "telemetry.h"
+#include "timer.h"
 
-void delay_ms(uint16_t);
+#ifndef SAMPLE_INTERVAL_MS
+#define SAMPLE_INTERVAL_MS 2000
+#endif
 
-int main(void)
+#ifndef OUTPUT_BINARY
+#define OUTPUT_BINARY 0
+#endif
+
+#ifndef OUTPUT_ALTITUDE
+#define OUTPUT_ALTITUDE 0
+#endif
+
+#ifndef REPORT_BY_EXCEPTION
+#define REPORT_BY_EXCEPTION 0
+#endif
+
+#ifndef STORE
+#define STORE 0
+#endif
+
+/*
+ * Pin that flushes the store on demand while it is held LOW, checked once
+ * per sample. Its pull-up is enabled, so a button to ground or an open-drain
+ * output of the host can drive it.
+ */
+#ifndef STORE_FLUSH_PIN
+#define STORE_FLUSH_PIN PB4
+#endif
+
+#if STORE && (STORE_FLUSH_PIN == PB1 || STORE_FLUSH_PIN == PB5)
+#error "STORE_FLUSH_PIN must not be the UART TX or RESET pin"
+#endif
+
+#if STORE && (I2C_PINS & (1 << STORE_FLUSH_PIN))
+#error "STORE_FLUSH_PIN must not be an I2C pin"
+#endif
+
+#if PROFILE && OUTPUT_BINARY
+#error "The profile is reported in text, use the text output with PROFILE"
+#endif
+
+/*
+ * Sends the temperature and pressure of the measurements, and in text the
+ * altitude and sea level pressure when OUTPUT_ALTITUDE is set
+ */
+static void output(const struct bmp180_measurements *measurements)
 {
-    char output[100];
-    struct bmp180_measurements measurements = {0};
+#if OUTPUT_BINARY && REPORT_BY_EXCEPTION
+    PROFILE_ENTER(PROFILE_SEND);
+    telemetry_send_delta(measurements);
+#elif OUTPUT_BINARY
+    PROFILE_ENTER(PROFILE_SEND);
+    telemetry_send(measurements);
+#else
+    PROFILE_ENTER(PROFILE_SEND);
+    usi_send_data_P(PSTR("Temperature: "));
+    PROFILE_ENTER(PROFILE_FORMAT);
+    format_int32(measurements->temperature);
+    PROFILE_ENTER(PROFILE_SEND);
+    usi_send_data_P(PSTR(u8" (0.1 °C)\tPressure: "));
+    PROFILE_ENTER(PROFILE_FORMAT);
+    format_int32(measurements->pressure);
+    PROFILE_ENTER(PROFILE_SEND);
+    usi_send_data_P(PSTR(" (Pa)"));
+#if OUTPUT_ALTITUDE
+    usi_send_data_P(PSTR("\tAltitude: "));
+    PROFILE_ENTER(PROFILE_FORMAT);
+    format_fixed(altitude_from_pressure(measurements->pressure), 1);
+    PROFILE_ENTER(PROFILE_SEND);
+    usi_send_data_P(PSTR(" (m)\tQNH: "));
+    PROFILE_ENTER(PROFILE_FORMAT);
+    format_int32(altitude_qnh(measurements->pressure));
+    PROFILE_ENTER(PROFILE_SEND);
+    usi_send_data_P(PSTR(" (Pa)"));
+#endif
+    usi_send_byte('\n');
+#endif
+    PROFILE_ENTER(PROFILE_OTHER);
+}
+
+#ifdef I2C_LANES
+#if OUTPUT_BINARY
+#error "Telemetry frames carry a single sensor, use the text output with I2C_LANES"
+#endif
+
+/*
+ * Measures the sensors on every lane at once, and sends a line for each. The
+ * filter, report and store follow a single sensor, so they are not used.
+ */
+static void run_lanes(void)
+{
+    struct bmp180_measurements measurements[I2C_LANE_COUNT];
+    struct bmp180_lanes lanes;
+    uint32_t next_sample;
+
+    bmp180_lanes_init(&lanes);
+
+    next_sample = timer_millis();
     while (1) {
-	bmp180_measure(&measurements);
-	sprintf(output, u8"Temperature: %ld (0.1 °C)\tPressure: %ld (Pa)\n", measurements.temperature, measurements.pressure);
-	usi_send_data(output);
-	delay_ms(2000);
+	next_sample += SAMPLE_INTERVAL_MS;
+	bmp180_lanes_start(&lanes, measurements);
+	while (bmp180_lanes_poll(&lanes) == BMP180_BUSY) {
+	    scheduler_idle();
+	}
+
+	uint8_t completed = bmp180_lanes_complete(&lanes);
+	for (uint8_t lane = 0; lane < I2C_LANE_COUNT; lane++) {
+	    usi_send_data_P(PSTR("Sensor "));
+	    format_int32(lane);
+	    usi_send_data_P(PSTR(": "));
+	    if (completed & (1 << lane)) {
+		output(&measurements[lane]);
+	    } else {
+		usi_send_data_P(PSTR("error\n"));
+	    }
+	}
+
+	scheduler_sleep_until(next_sample);
     }
 }
+#endif
 
-void delay_ms(uint16_t ms)
+int main(void)
 {
-    while (--ms > 0)
-        _delay_ms(1);
+    struct bmp180_measurements measurements = {0};
+    struct bmp180_measurements sample;
+    uint8_t started = 0;
+#if PROFILE
+    uint8_t profiled = 0;
+#endif
+    struct bmp180_context context;
+    struct filter filter;
+    struct report report;
+    enum bmp180_status status;
+    uint32_t next_sample;
+
+    timer_init();
+    usi_init();
+    scheduler_init();
+    bmp180_init(&context);
+    filter_init(&filter, FILTER_MODE, FILTER_SHIFT);
+    report_init(&report);
+#if OUTPUT_ALTITUDE
+    altitude_set_station(STATION_ALTITUDE);
+#endif
+#ifdef I2C_LANES
+    run_lanes();
+#endif
+#if STORE
+    store_init();
+    PORTB |= (1 << STORE_FLUSH_PIN);
+#endif
+
+    next_sample = timer_millis();
+    while (1) {
+	PROFILE_ENTER(PROFILE_SLEEP);
+	scheduler_sleep_until(next_sample);
+	next_sample += SAMPLE_INTERVAL_MS;
+
+	/*
+	 * The sensor converts in the background, so sleep until the next
+	 * millisecond tick while it is busy. The UART carries on sending the
+	 * previous sample from its interrupt meanwhile. A sample started
+	 * while the previous one was compensated is already converting.
+	 */
+	if (!started) {
+	    bmp180_start(&context, &measurements);
+	}
+	started = 0;
+	while ((status = bmp180_poll(&context)) == BMP180_BUSY) {
+	    scheduler_idle();
+#if STORE
+	    store_poll();
+#endif
+	}
+
+	/*
+	 * Compensate and queue the sample as soon as it is read, so that it is
+	 * sent while the next one converts. When the next sample is already
+	 * due, its temperature conversion is started first from the raw
+	 * results kept aside, so that the sensor converts while this one is
+	 * compensated. A sample that failed on the bus is skipped, and the
+	 * next one starts afresh.
+	 */
+	if (status == BMP180_READY) {
+	    sample = measurements;
+	    if ((int32_t) (next_sample - timer_millis()) <= 0) {
+		bmp180_start(&context, &measurements);
+		bmp180_poll(&context);
+		started = 1;
+	    }
+
+	    bmp180_compensate(&context, &sample);
+	    if (filter_update(&filter, &sample)
+		    && (!REPORT_BY_EXCEPTION || report_update(&report, &sample, timer_millis()))) {
+#if STORE
+		/*
+		 * Send the samples in bursts once enough have accumulated
+		 */
+		if (store_add(&sample)) {
+		    store_flush(output);
+		}
+#else
+		output(&sample);
+#endif
+	    }
+	} else if (!OUTPUT_BINARY) {
+	    usi_send_data_P(PSTR("Sensor error\n"));
+	}
+
+#if STORE
+	if (!(PINB & (1 << STORE_FLUSH_PIN)) && store_count()) {
+	    store_flush(output);
+	}
+#endif
+
+#if PROFILE
+	if (++profiled == PROFILE_REPORT_SAMPLES) {
+	    profiled = 0;
+	    profile_report();
+	}
+#endif
+    }
 }
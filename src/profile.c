@@ -0,0 +1,95 @@
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "format.h"
+#include "profile.h"
+#include "timer.h"
+#include "usi.h"
+
+#if PROFILE
+
+#define NAME_LENGTH 10
+
+static const char phase_names[PROFILE_PHASES][NAME_LENGTH] PROGMEM = {
+    "other",
+    "start",
+    "address",
+    "write",
+    "restart",
+    "read",
+    "stop",
+    "recover",
+    "wait",
+    "calculate",
+    "format",
+    "send",
+    "sleep",
+};
+
+static const char counter_names[PROFILE_COUNTERS][NAME_LENGTH] PROGMEM = {
+    "bytes",
+    "naks",
+    "retries",
+};
+
+enum profile_phase profile_phase = PROFILE_OTHER;
+
+static uint32_t entered;
+static uint32_t ticks[PROFILE_PHASES];
+static uint16_t entries[PROFILE_PHASES];
+static uint16_t counters[PROFILE_COUNTERS];
+
+/*
+ * Ends the current phase and enters the given one
+ */
+void profile_enter(enum profile_phase phase)
+{
+    uint32_t now = timer_ticks();
+
+    ticks[profile_phase] += now - entered;
+    entered = now;
+    profile_phase = phase;
+    entries[phase]++;
+}
+
+/*
+ * Counts an event
+ */
+void profile_count(enum profile_counter counter)
+{
+    counters[counter]++;
+}
+
+/*
+ * Sends the phases and counters, one per line, then starts counting afresh
+ */
+void profile_report(void)
+{
+    profile_enter(PROFILE_OTHER);
+
+    for (uint8_t phase = 0; phase < PROFILE_PHASES; phase++) {
+	usi_send_data_P(phase_names[phase]);
+	usi_send_byte('\t');
+	format_int32(entries[phase]);
+	usi_send_byte('\t');
+	format_int32(ticks[phase] * (1000 / TIMER_TICKS_PER_MS));
+	usi_send_data_P(PSTR(" (us)\n"));
+	ticks[phase] = 0;
+	entries[phase] = 0;
+    }
+
+    for (uint8_t counter = 0; counter < PROFILE_COUNTERS; counter++) {
+	usi_send_data_P(counter_names[counter]);
+	usi_send_byte('\t');
+	format_int32(counters[counter]);
+	usi_send_byte('\n');
+	counters[counter] = 0;
+    }
+
+    /*
+     * The report itself is not counted
+     */
+    entered = timer_ticks();
+}
+
+#endif
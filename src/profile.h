@@ -0,0 +1,85 @@
+#include <stdint.h>
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/*
+ * Optional profiling: 1 times the phases of the measurements on Timer/Counter
+ * 1 and counts the bus activity, 0 compiles the hooks to nothing. Timer/Counter
+ * 1 is the millisecond clock, prescaled to 250kHz, so the phases are timed to
+ * 4us: 4 cycles at 1MHz, 32 at 8MHz and 64 at 16MHz. Short phases add up
+ * over the samples between reports, but a single entry is not cycle accurate.
+ */
+#ifndef PROFILE
+#define PROFILE 0
+#endif
+
+/*
+ * Number of samples between profile reports
+ */
+#ifndef PROFILE_REPORT_SAMPLES
+#define PROFILE_REPORT_SAMPLES 16
+#endif
+
+/*
+ * Represents the phases timed. Each hook enters a phase and ends the previous
+ * one; time outside the hooked code is counted as PROFILE_OTHER. The bus
+ * phases are entered between bytes, never between the edges of a bit.
+ */
+enum profile_phase {
+    PROFILE_OTHER,
+    PROFILE_START,
+    PROFILE_ADDRESS,
+    PROFILE_WRITE,
+    PROFILE_RESTART,
+    PROFILE_READ,
+    PROFILE_STOP,
+    PROFILE_RECOVER,
+    PROFILE_WAIT,
+    PROFILE_CALCULATE,
+    PROFILE_FORMAT,
+    PROFILE_SEND,
+    PROFILE_SLEEP,
+    PROFILE_PHASES
+};
+
+/*
+ * Represents the events counted
+ */
+enum profile_counter { PROFILE_BYTES, PROFILE_NAKS, PROFILE_RETRIES, PROFILE_COUNTERS };
+
+#if PROFILE
+
+extern enum profile_phase profile_phase;
+
+/*
+ * Ends the current phase and enters the given one
+ */
+void profile_enter(enum profile_phase phase);
+
+/*
+ * Counts an event
+ */
+void profile_count(enum profile_counter counter);
+
+/*
+ * Sends the time spent in each phase, in microseconds, and the counters over
+ * the UART, then starts counting afresh
+ */
+void profile_report(void);
+
+/*
+ * The hooks are called for every byte on the bus and every poll while
+ * waiting for a conversion, so only call out when the phase changes
+ */
+#define PROFILE_ENTER(phase) do { if (profile_phase != (phase)) profile_enter(phase); } while (0)
+#define PROFILE_COUNT(counter) profile_count(counter)
+
+#else
+
+#define PROFILE_ENTER(phase) ((void) 0)
+#define PROFILE_COUNT(counter) ((void) 0)
+
+#endif
+
+#endif
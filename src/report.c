@@ -0,0 +1,41 @@
+#include "report.h"
+
+static uint8_t report_exceeds(int32_t value, int32_t reported, int32_t deadband)
+{
+    int32_t change = value - reported;
+    return change > deadband || change < -deadband;
+}
+
+/*
+ * Initialises the report so that the first sample is reported
+ */
+void report_init(struct report *report)
+{
+    report->temperature = 0;
+    report->pressure = 0;
+    report->reported_at = 0;
+    report->reported = 0;
+}
+
+/*
+ * Returns non-zero when the measurements are to be reported
+ */
+uint8_t report_update(struct report *report, const struct bmp180_measurements *measurements, uint32_t now)
+{
+    /*
+     * Compare against the last sample reported rather than the last one
+     * taken, so that a slow drift is reported once it adds up
+     */
+    if (report->reported
+	    && now - report->reported_at < REPORT_HEARTBEAT_MS
+	    && !report_exceeds(measurements->temperature, report->temperature, REPORT_TEMPERATURE_DEADBAND)
+	    && !report_exceeds(measurements->pressure, report->pressure, REPORT_PRESSURE_DEADBAND)) {
+	return 0;
+    }
+
+    report->temperature = measurements->temperature;
+    report->pressure = measurements->pressure;
+    report->reported_at = now;
+    report->reported = 1;
+    return 1;
+}
@@ -0,0 +1,46 @@
+#include <stdint.h>
+
+#ifndef REPORT_H
+#define REPORT_H
+
+#include "bmp180.h"
+
+/*
+ * Default deadbands, in 0.1 °C and Pa, and heartbeat interval in ms. A sample
+ * is reported when it differs from the last one reported by more than a
+ * deadband, or when the heartbeat interval has passed since.
+ */
+#ifndef REPORT_TEMPERATURE_DEADBAND
+#define REPORT_TEMPERATURE_DEADBAND 2
+#endif
+
+#ifndef REPORT_PRESSURE_DEADBAND
+#define REPORT_PRESSURE_DEADBAND 12
+#endif
+
+#ifndef REPORT_HEARTBEAT_MS
+#define REPORT_HEARTBEAT_MS 60000
+#endif
+
+/*
+ * Represents the last sample reported and when
+ */
+struct report {
+    int32_t temperature;
+    int32_t pressure;
+    uint32_t reported_at;
+    uint8_t reported;
+};
+
+/*
+ * Initialises the report so that the first sample is reported
+ */
+void report_init(struct report *report);
+
+/*
+ * Returns non-zero, and records the sample as reported at the time in ms,
+ * when the temperature and pressure of the measurements are to be reported
+ */
+uint8_t report_update(struct report *report, const struct bmp180_measurements *measurements, uint32_t now);
+
+#endif
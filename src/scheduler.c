@@ -0,0 +1,107 @@
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+#include "scheduler.h"
+#include "timer.h"
+#include "usi.h"
+
+/*
+ * The shortest watchdog period in milliseconds. The watchdog can wake up
+ * after this period times any power of two up to 512.
+ */
+#define WATCHDOG_MIN_MS 16
+#define WATCHDOG_PERIODS 10
+
+ISR(WDT_vect)
+{
+    /*
+     * Nothing to do, the interrupt only wakes the CPU up
+     */
+}
+
+/*
+ * Turns off the peripherals that are not used
+ */
+void scheduler_init(void)
+{
+    ADCSRA &= ~(1 << ADEN);
+    ACSR |= (1 << ACD);
+}
+
+/*
+ * Sleeps in idle mode until the next interrupt
+ */
+void scheduler_idle(void)
+{
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_mode();
+}
+
+/*
+ * Powers down for the given watchdog period, 16ms times 2 to the power of
+ * the given index
+ */
+static void scheduler_power_down(uint8_t period)
+{
+    /*
+     * Set the watchdog to raise an interrupt instead of resetting. The new
+     * value must be written within 4 cycles of setting WDCE, so it is worked
+     * out beforehand and the two writes follow each other.
+     */
+    uint8_t control = (1 << WDIE) | ((period & 0x08) ? (1 << WDP3) : 0) | (period & 0x07);
+
+    cli();
+    wdt_reset();
+    MCUSR &= ~(1 << WDRF);
+    WDTCR = (1 << WDCE) | (1 << WDE);
+    WDTCR = control;
+
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+
+    wdt_disable();
+}
+
+/*
+ * Sleeps until the millisecond clock reaches the given time
+ */
+void scheduler_sleep_until(uint32_t time)
+{
+    while ((int32_t) (time - timer_millis()) >= WATCHDOG_MIN_MS) {
+	/*
+	 * Timer/Counter 0 stops when powered down, so let the UART finish
+	 * first. Without a power-down it carries on sending into the next
+	 * sample.
+	 */
+	usi_flush();
+
+	uint32_t remaining = time - timer_millis();
+	uint8_t period = 0;
+
+	if ((int32_t) remaining < WATCHDOG_MIN_MS) {
+	    break;
+	}
+
+	while (period < WATCHDOG_PERIODS - 1 && ((uint32_t) WATCHDOG_MIN_MS << (period + 1)) <= remaining) {
+	    period++;
+	}
+
+	/*
+	 * The millisecond clock stops too, so move it on by the time slept
+	 */
+	scheduler_power_down(period);
+	timer_advance((uint16_t) WATCHDOG_MIN_MS << period);
+    }
+
+    /*
+     * Wait out the rest in idle mode, woken by the millisecond clock
+     */
+    while ((int32_t) (time - timer_millis()) > 0) {
+	scheduler_idle();
+    }
+}
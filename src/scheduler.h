@@ -0,0 +1,24 @@
+#include <avr/io.h>
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+/*
+ * Turns off the peripherals that are not used so that they draw no current
+ * while sleeping
+ */
+void scheduler_init(void);
+
+/*
+ * Sleeps in idle mode until the next interrupt, such as the millisecond clock
+ */
+void scheduler_idle(void);
+
+/*
+ * Sleeps in power-down mode, woken by the watchdog, until the millisecond
+ * clock reaches the given time. The UART queue is drained only before a
+ * power-down, and keeps sending when the time is too short for one.
+ */
+void scheduler_sleep_until(uint32_t time);
+
+#endif
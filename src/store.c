@@ -0,0 +1,220 @@
+#include <avr/eeprom.h>
+#include <avr/io.h>
+
+#include "store.h"
+
+#if STORE_RAM_RECORDS > 255 || STORE_EEPROM_RECORDS > 255
+#error "The store holds at most 255 records in RAM and in EEPROM"
+#endif
+
+#if STORE_FLUSH_THRESHOLD > STORE_RAM_RECORDS + STORE_EEPROM_RECORDS
+#error "The flush threshold is larger than the store"
+#endif
+
+/*
+ * Ring of the most recent samples. When it is full, the oldest sample moves
+ * to the EEPROM ring, so the EEPROM ring always holds older samples than RAM.
+ */
+static struct store_record ram_records[STORE_RAM_RECORDS];
+static uint8_t ram_head = 0;
+static uint8_t ram_count = 0;
+
+static uint8_t ring_index(uint8_t head, uint8_t count, uint8_t size)
+{
+    uint16_t index = (uint16_t) head + count;
+    return index >= size ? index - size : index;
+}
+
+#if STORE_EEPROM_RECORDS
+/*
+ * A sample in EEPROM, numbered in the order it was spilled. The number comes
+ * last, so a slot whose write was cut short keeps its old number.
+ */
+struct store_slot {
+    struct store_record record;
+    uint16_t sequence;
+};
+
+/*
+ * Erased EEPROM reads as this number, which is never given to a sample
+ */
+#define SEQUENCE_EMPTY 0xFFFF
+
+static struct store_slot EEMEM eeprom_slots[STORE_EEPROM_RECORDS];
+
+/*
+ * Number of the oldest sample not flushed yet, written by each flush. With
+ * the numbers in the slots, it gives the ring back after a reset.
+ */
+static uint16_t EEMEM eeprom_unflushed;
+
+static uint8_t eeprom_head = 0;
+static uint8_t eeprom_count = 0;
+static uint16_t next_sequence = 0;
+
+/*
+ * The slot being written in the background, and the number of its bytes
+ * written so far
+ */
+static struct store_slot spill;
+static uint8_t *spill_target;
+static uint8_t spill_written = sizeof(spill);
+
+static uint16_t sequence_after(uint16_t sequence)
+{
+    return sequence + 1 == SEQUENCE_EMPTY ? 0 : sequence + 1;
+}
+
+static uint16_t sequence_before(uint16_t sequence)
+{
+    return sequence == 0 ? SEQUENCE_EMPTY - 1 : sequence - 1;
+}
+
+static uint16_t slot_sequence(uint8_t slot)
+{
+    return eeprom_read_word(&eeprom_slots[slot].sequence);
+}
+
+/*
+ * Writes the spilled slot to completion, at most one slot
+ */
+static void store_finish(void)
+{
+    while (spill_written < sizeof(spill)) {
+	eeprom_busy_wait();
+	store_poll();
+    }
+}
+#endif
+
+void store_init(void)
+{
+#if STORE_EEPROM_RECORDS
+    uint16_t unflushed = eeprom_read_word(&eeprom_unflushed);
+    uint16_t flushed = SEQUENCE_EMPTY;
+
+    if (unflushed != SEQUENCE_EMPTY) {
+	next_sequence = unflushed;
+	flushed = sequence_before(unflushed);
+    }
+
+    /*
+     * The newest slot is the one not followed by the next number. Count back
+     * from it the samples not flushed yet, as far as the numbers run on.
+     */
+    for (uint8_t newest = 0; newest < STORE_EEPROM_RECORDS; newest++) {
+	uint16_t sequence = slot_sequence(newest);
+
+	if (sequence == SEQUENCE_EMPTY || slot_sequence(ring_index(newest, 1, STORE_EEPROM_RECORDS)) == sequence_after(sequence)) {
+	    continue;
+	}
+
+	next_sequence = sequence_after(sequence);
+	uint8_t slot = newest;
+	while (sequence != flushed && eeprom_count < STORE_EEPROM_RECORDS
+		&& slot_sequence(slot) == sequence) {
+	    eeprom_count++;
+	    sequence = sequence_before(sequence);
+	    slot = slot ? slot - 1 : STORE_EEPROM_RECORDS - 1;
+	}
+	eeprom_head = ring_index(ring_index(newest, 1, STORE_EEPROM_RECORDS), STORE_EEPROM_RECORDS - eeprom_count, STORE_EEPROM_RECORDS);
+	break;
+    }
+#endif
+}
+
+void store_poll(void)
+{
+#if STORE_EEPROM_RECORDS
+    /*
+     * Bytes that are unchanged need no write, so carry on until one does
+     */
+    while (spill_written < sizeof(spill) && eeprom_is_ready()) {
+	eeprom_update_byte(spill_target + spill_written, ((uint8_t *) &spill)[spill_written]);
+	spill_written++;
+    }
+#endif
+}
+
+/*
+ * Takes the oldest sample out of RAM, moving it to EEPROM if there is one.
+ * The slot is written in the background by store_poll().
+ */
+static void store_spill(void)
+{
+#if STORE_EEPROM_RECORDS
+    /*
+     * Drop the oldest sample in EEPROM if it is full too
+     */
+    if (eeprom_count == STORE_EEPROM_RECORDS) {
+	eeprom_head = ring_index(eeprom_head, 1, STORE_EEPROM_RECORDS);
+	eeprom_count--;
+    }
+
+    store_finish();
+    spill.record = ram_records[ram_head];
+    spill.sequence = next_sequence;
+    next_sequence = sequence_after(next_sequence);
+    spill_target = (uint8_t *) &eeprom_slots[ring_index(eeprom_head, eeprom_count, STORE_EEPROM_RECORDS)];
+    spill_written = 0;
+    eeprom_count++;
+#endif
+
+    ram_head = ring_index(ram_head, 1, STORE_RAM_RECORDS);
+    ram_count--;
+}
+
+uint8_t store_add(const struct bmp180_measurements *measurements)
+{
+    if (ram_count == STORE_RAM_RECORDS) {
+	store_spill();
+    }
+
+    struct store_record *record = &ram_records[ring_index(ram_head, ram_count, STORE_RAM_RECORDS)];
+    record->temperature = measurements->temperature;
+    record->pressure[0] = measurements->pressure;
+    record->pressure[1] = measurements->pressure >> 8;
+    record->pressure[2] = measurements->pressure >> 16;
+    ram_count++;
+
+    return store_count() >= STORE_FLUSH_THRESHOLD;
+}
+
+uint16_t store_count(void)
+{
+#if STORE_EEPROM_RECORDS
+    return ram_count + eeprom_count;
+#else
+    return ram_count;
+#endif
+}
+
+static void store_send(const struct store_record *record, void (*send)(const struct bmp180_measurements *measurements))
+{
+    struct bmp180_measurements measurements = {0};
+
+    measurements.temperature = record->temperature;
+    measurements.pressure = (int32_t) record->pressure[2] << 16 | (uint16_t) record->pressure[1] << 8 | record->pressure[0];
+    send(&measurements);
+}
+
+void store_flush(void (*send)(const struct bmp180_measurements *measurements))
+{
+#if STORE_EEPROM_RECORDS
+    store_finish();
+    while (eeprom_count) {
+	struct store_record record;
+	eeprom_read_block(&record, &eeprom_slots[eeprom_head].record, sizeof(record));
+	store_send(&record, send);
+	eeprom_head = ring_index(eeprom_head, 1, STORE_EEPROM_RECORDS);
+	eeprom_count--;
+    }
+    eeprom_update_word(&eeprom_unflushed, next_sequence);
+#endif
+
+    while (ram_count) {
+	store_send(&ram_records[ram_head], send);
+	ram_head = ring_index(ram_head, 1, STORE_RAM_RECORDS);
+	ram_count--;
+    }
+}
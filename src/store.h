@@ -0,0 +1,69 @@
+#include <avr/io.h>
+
+#ifndef STORE_H
+#define STORE_H
+
+#include "bmp180.h"
+
+/*
+ * Number of samples kept in RAM
+ */
+#ifndef STORE_RAM_RECORDS
+#define STORE_RAM_RECORDS 16
+#endif
+
+/*
+ * Number of further samples kept in EEPROM once RAM is full, 0 to drop the
+ * oldest sample instead. The samples in EEPROM outlast a reset, those in RAM
+ * do not.
+ */
+#ifndef STORE_EEPROM_RECORDS
+#define STORE_EEPROM_RECORDS 0
+#endif
+
+/*
+ * Number of samples to accumulate before they are flushed
+ */
+#ifndef STORE_FLUSH_THRESHOLD
+#define STORE_FLUSH_THRESHOLD STORE_RAM_RECORDS
+#endif
+
+/*
+ * Represents a stored sample: temperature in 0.1 °C and pressure in Pa, least
+ * significant byte first
+ */
+struct store_record {
+    int16_t temperature;
+    uint8_t pressure[3];
+};
+
+/*
+ * Finds the samples left in EEPROM by the last run that were not flushed
+ */
+void store_init(void);
+
+/*
+ * Carries on writing the sample last moved to EEPROM, without waiting for the
+ * EEPROM. Each byte takes about 3.4ms to write, so call it while idle.
+ */
+void store_poll(void);
+
+/*
+ * Adds the temperature and pressure of the measurements to the store. Moving
+ * a sample to EEPROM waits at most for the write of the previous one to
+ * finish. Returns non-zero when the flush threshold has been reached.
+ */
+uint8_t store_add(const struct bmp180_measurements *measurements);
+
+/*
+ * Returns the number of samples in the store
+ */
+uint16_t store_count(void);
+
+/*
+ * Passes every stored sample, oldest first, to the given function and empties
+ * the store, marking the samples in EEPROM as flushed
+ */
+void store_flush(void (*send)(const struct bmp180_measurements *measurements));
+
+#endif
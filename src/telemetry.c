@@ -0,0 +1,111 @@
+#include "hal.h"
+
+#include "bmp180.h"
+#include "telemetry.h"
+#include "usi.h"
+
+static uint16_t sequence = 0;
+
+/*
+ * Last temperature and pressure sent, and the number of delta frames since
+ * the last sample frame
+ */
+static int16_t last_temperature;
+static int32_t last_pressure;
+static uint8_t deltas = TELEMETRY_KEYFRAME_INTERVAL;
+
+/*
+ * Sends a frame COBS-encoded, followed by the zero delimiter. Each zero in the
+ * frame is replaced by the distance to the next zero, or to the end.
+ */
+static void telemetry_send_frame(const uint8_t *frame, uint8_t length)
+{
+    uint8_t start = 0;
+
+    while (start <= length) {
+	uint8_t end = start;
+	while (end < length && frame[end] != 0) {
+	    end++;
+	}
+
+	usi_send_byte(end - start + 1);
+	while (start < end) {
+	    usi_send_byte(frame[start++]);
+	}
+	start = end + 1;
+    }
+
+    usi_send_byte(0);
+}
+
+/*
+ * Appends the CRC to the frame and sends it
+ */
+static void telemetry_send_fields(uint8_t *frame, uint8_t length)
+{
+    uint16_t crc = TELEMETRY_CRC_INIT;
+
+    for (uint8_t i = 0; i < length; i++) {
+	crc = telemetry_crc_update(crc, frame[i]);
+    }
+    frame[length++] = crc;
+    frame[length++] = crc >> 8;
+
+    telemetry_send_frame(frame, length);
+    sequence++;
+}
+
+/*
+ * Sends the temperature and pressure of the measurements as a sample frame
+ */
+void telemetry_send(const struct bmp180_measurements *measurements)
+{
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+    uint8_t length = 0;
+
+    frame[length++] = TELEMETRY_SAMPLE;
+    frame[length++] = sequence;
+    frame[length++] = sequence >> 8;
+    frame[length++] = measurements->temperature;
+    frame[length++] = measurements->temperature >> 8;
+    frame[length++] = measurements->pressure;
+    frame[length++] = measurements->pressure >> 8;
+    frame[length++] = measurements->pressure >> 16;
+
+    last_temperature = measurements->temperature;
+    last_pressure = measurements->pressure;
+    deltas = 0;
+    telemetry_send_fields(frame, length);
+}
+
+/*
+ * Sends the temperature and pressure of the measurements as a delta frame
+ * when it can
+ */
+void telemetry_send_delta(const struct bmp180_measurements *measurements)
+{
+    int16_t temperature = measurements->temperature - last_temperature;
+    int32_t pressure = measurements->pressure - last_pressure;
+
+    if (deltas >= TELEMETRY_KEYFRAME_INTERVAL
+	    || temperature < INT8_MIN || temperature > INT8_MAX
+	    || pressure < INT16_MIN || pressure > INT16_MAX) {
+	telemetry_send(measurements);
+	return;
+    }
+
+    uint8_t frame[TELEMETRY_FRAME_MAX];
+    uint8_t length = 0;
+
+    frame[length++] = TELEMETRY_DELTA;
+    frame[length++] = sequence;
+    frame[length++] = sequence >> 8;
+    frame[length++] = temperature;
+    frame[length++] = pressure;
+    frame[length++] = pressure >> 8;
+
+    last_temperature = measurements->temperature;
+    last_pressure = measurements->pressure;
+    deltas++;
+    telemetry_send_fields(frame, length);
+}
@@ -0,0 +1,80 @@
+#include <stdint.h>
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+struct bmp180_measurements;
+
+/*
+ * Binary telemetry frames. Each frame is COBS-encoded and terminated with a
+ * zero byte, so a receiver can resynchronise at any delimiter. The decoded
+ * frame is, with multi-byte fields little-endian:
+ *
+ *   type (1) | sequence (2) | fields (depends on type) | CRC-16 (2)
+ *
+ * The CRC is avr-libc's _crc_ccitt_update() over the type, sequence and
+ * fields, starting from 0xFFFF.
+ */
+
+/*
+ * Frame types
+ */
+#define TELEMETRY_SAMPLE 0x01
+#define TELEMETRY_DELTA  0x02
+
+/*
+ * Length of the fields of a sample frame: temperature in 0.1 °C (2) and
+ * pressure in Pa (3)
+ */
+#define TELEMETRY_SAMPLE_FIELDS 5
+
+/*
+ * Length of the fields of a delta frame: the change since the frame with the
+ * previous sequence number in temperature (1, signed) and pressure (2, signed)
+ */
+#define TELEMETRY_DELTA_FIELDS 3
+
+/*
+ * Default number of frames sent by telemetry_send_delta() between sample
+ * frames, so that a receiver that lost a frame can resynchronise
+ */
+#ifndef TELEMETRY_KEYFRAME_INTERVAL
+#define TELEMETRY_KEYFRAME_INTERVAL 16
+#endif
+
+/*
+ * Length of the largest decoded frame, and of its COBS encoding
+ */
+#define TELEMETRY_FRAME_MAX (1 + 2 + TELEMETRY_SAMPLE_FIELDS + 2)
+#define TELEMETRY_ENCODED_MAX (TELEMETRY_FRAME_MAX + 1)
+
+#define TELEMETRY_CRC_INIT 0xFFFF
+
+#ifdef __AVR__
+#include <util/crc16.h>
+#define telemetry_crc_update(crc, byte) _crc_ccitt_update(crc, byte)
+#else
+/*
+ * Updates the frame CRC with a byte, as avr-libc's _crc_ccitt_update()
+ */
+static inline uint16_t telemetry_crc_update(uint16_t crc, uint8_t byte)
+{
+    byte ^= crc & 0xFF;
+    byte ^= byte << 4;
+    return ((uint16_t) byte << 8 | crc >> 8) ^ (uint8_t) (byte >> 4) ^ ((uint16_t) byte << 3);
+}
+#endif
+
+/*
+ * Sends the temperature and pressure of the measurements as a sample frame
+ */
+void telemetry_send(const struct bmp180_measurements *measurements);
+
+/*
+ * Sends the temperature and pressure of the measurements as a delta frame
+ * against the last frame sent, or as a sample frame if there is none, the
+ * change does not fit or a keyframe is due
+ */
+void telemetry_send_delta(const struct bmp180_measurements *measurements);
+
+#endif
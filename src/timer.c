@@ -0,0 +1,86 @@
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include "timer.h"
+
+/*
+ * Timer/Counter 1 is clocked at 250kHz, so that it reaches the compare value
+ * once every millisecond.
+ */
+#if F_CPU == 1000000UL
+#define TIMER_PRESCALER ((1 << CS11) | (1 << CS10))
+#elif F_CPU == 8000000UL
+#define TIMER_PRESCALER ((1 << CS12) | (1 << CS11))
+#elif F_CPU == 16000000UL
+#define TIMER_PRESCALER ((1 << CS12) | (1 << CS11) | (1 << CS10))
+#else
+#error "Unsupported F_CPU for the millisecond clock"
+#endif
+
+static volatile uint32_t millis = 0;
+
+/*
+ * Let the USI overflow interrupt in, so that it is not late loading the
+ * next bits at high baud rates
+ */
+ISR(TIMER1_COMPA_vect, ISR_NOBLOCK)
+{
+    millis++;
+}
+
+void timer_init(void)
+{
+    /*
+     * Clear the counter when it matches OCR1C, and raise the compare A
+     * interrupt at the same count.
+     */
+    TCCR1 = (1 << CTC1) | TIMER_PRESCALER;
+    OCR1C = TIMER_TICKS_PER_MS - 1;
+    OCR1A = TIMER_TICKS_PER_MS - 1;
+    TCNT1 = 0;
+    TIMSK |= (1 << OCIE1A);
+
+    sei();
+}
+
+uint32_t timer_millis(void)
+{
+    uint32_t value;
+
+    /*
+     * The counter is 32 bits wide, so it must not change while it is being
+     * copied.
+     */
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+	value = millis;
+    }
+    return value;
+}
+
+void timer_advance(uint16_t ms)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+	millis += ms;
+    }
+}
+
+uint32_t timer_ticks(void)
+{
+    uint32_t ms;
+    uint8_t count;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+	ms = millis;
+	count = TCNT1;
+
+	/*
+	 * The counter may have been cleared without the interrupt having
+	 * counted the millisecond yet
+	 */
+	if ((TIFR & (1 << OCF1A)) && count < TIMER_TICKS_PER_MS - 1) {
+	    ms++;
+	}
+    }
+    return ms * TIMER_TICKS_PER_MS + count;
+}
@@ -0,0 +1,33 @@
+#include <stdint.h>
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/*
+ * Timer/Counter 1 counts this many ticks per millisecond, whatever F_CPU
+ */
+#define TIMER_TICKS_PER_MS 250
+
+/*
+ * Starts the millisecond clock on Timer/Counter 1
+ */
+void timer_init(void);
+
+/*
+ * Returns the number of milliseconds elapsed since timer_init()
+ */
+uint32_t timer_millis(void);
+
+/*
+ * Moves the clock on by the given number of milliseconds, for time spent with
+ * the timer stopped
+ */
+void timer_advance(uint16_t ms);
+
+/*
+ * Returns the number of Timer/Counter 1 ticks elapsed since timer_init(), for
+ * timing to 1/TIMER_TICKS_PER_MS ms
+ */
+uint32_t timer_ticks(void);
+
+#endif
@@ -1,10 +1,77 @@
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 
 #include "usi.h"
 
+#ifndef BAUD_RATE
+#define BAUD_RATE 9600UL
+#endif
+
+/*
+ * Timer/Counter 0 clocks out a bit every BIT_TICKS counts of the CPU clock
+ * divided by the prescaler. Take the smallest prescaler for which a bit fits
+ * in the 8-bit counter, for the finest resolution.
+ */
+#define BIT_TICKS(prescaler) ((F_CPU + (prescaler) * BAUD_RATE / 2) / ((prescaler) * BAUD_RATE))
+
+#if BIT_TICKS(1) <= 256
+#define PRESCALER      1
+#define PRESCALER_BITS (1 << CS00)
+#elif BIT_TICKS(8) <= 256
+#define PRESCALER      8
+#define PRESCALER_BITS (1 << CS01)
+#elif BIT_TICKS(64) <= 256
+#define PRESCALER      64
+#define PRESCALER_BITS ((1 << CS01) | (1 << CS00))
+#elif BIT_TICKS(256) <= 256
+#define PRESCALER      256
+#define PRESCALER_BITS (1 << CS02)
+#elif BIT_TICKS(1024) <= 256
+#define PRESCALER      1024
+#define PRESCALER_BITS ((1 << CS02) | (1 << CS00))
+#else
+#error "BAUD_RATE is too slow for Timer/Counter 0 at this F_CPU"
+#endif
+
+#define BIT_CYCLES (PRESCALER * BIT_TICKS(PRESCALER))
+
+/*
+ * A receiver samples in the middle of each bit, so a frame of 10 bits
+ * tolerates a few percent between both ends; allow up to 2% here
+ */
+#if (F_CPU > BIT_CYCLES * BAUD_RATE ? F_CPU - BIT_CYCLES * BAUD_RATE : BIT_CYCLES * BAUD_RATE - F_CPU) * 50 > F_CPU
+#error "BAUD_RATE is more than 2% off at this F_CPU"
+#endif
+
+/*
+ * The overflow interrupt must load the last two bits before the next bit is
+ * clocked out, which takes about 30 cycles
+ */
+#if BIT_CYCLES < 64
+#error "BAUD_RATE is too fast for the USI overflow interrupt at this F_CPU"
+#endif
+
+/*
+ * Size of the transmit queue, large enough for a whole line of output; must
+ * be a power of two
+ */
+#define QUEUE_SIZE 64
+#define QUEUE_MASK (QUEUE_SIZE - 1)
+
 static volatile uint8_t second_byte_sent = 0;
-static volatile uint8_t buffer_empty = 1;
+static volatile uint8_t busy = 0;
+static volatile uint8_t suspended = 0;
+
+/*
+ * Bytes waiting to be sent. The producer only moves the head and the
+ * interrupt only moves the tail, so a single byte index can be read without
+ * disabling interrupts.
+ */
+static volatile char queue[QUEUE_SIZE];
+static volatile uint8_t queue_head = 0;
+static volatile uint8_t queue_tail = 0;
 
 /*
  * The ATtiny85 has an 8-bit data register, but we need to send a total of 10
@@ -17,37 +84,6 @@ static volatile uint8_t buffer_empty = 1;
  */
 static char second_byte;
 
-ISR(USI_OVF_vect)
-{
-    /*
-     * This interrupt is triggered when the bit counter overflows.
-     * If it is not the overflow for the second byte, send the data for the
-     * second byte and set the byte counter to overflow after the next two bits
-     * are sent.
-     * Otherwise, set the TX port to HIGH and turn off USI.
-     */
-    if (!second_byte_sent) {
-	second_byte_sent = 1;
-	DATA = second_byte;
-
-	/*
-	 * Set the counter value to 0x0E so that it overflows after the next
-	 * two bits (16 - 0x0E) are sent.
-	 */
-	 STATUS |= 0x0E;
-    } else {
-	PORTB |= (1 << TX);
-	CONTROL = 0;
-	buffer_empty = 1;
-    }
-
-    /*
-     * Clear the overflow interrupt flag so that the next interrupt can be
-     * triggered
-     */
-    STATUS |= (1 << USIOIF);
-}
-
 static uint8_t reverse(char b)
 {
     /*
@@ -59,41 +95,14 @@ static uint8_t reverse(char b)
     return b;
 }
 
-static void usi_init(void)
-{
-    /*
-     * Set TX to output
-     */
-    DDRB |= (1 << TX);
-    
-    /*
-     * Set the Timer/Counter 0 to CTC mode. In this mode, it will overflow when
-     * it reaches the value in OCR0A.
-     */
-    TCCR0A |= (1 << WGM01);
-
-    /*
-     * Disable pre-scaling
-     */
-    TCCR0B |= (1 << CS00);
-
-    /*
-     * Set the overflow value to 0x68. At a clock frequency of 1MHz, this
-     * yields 9600bps.
-     */
-    OCR0A |= 0x68; 
-
-    sei();
-}
-
-static void usi_send_byte(char byte)
+/*
+ * Takes the next byte from the queue and starts sending it. Must be called
+ * with interrupts disabled.
+ */
+static void usi_send_next(void)
 {
-    usi_init();
-
-    /*
-     * Set the TX port to high
-     */
-    PORTB |= 1 << TX;
+    char byte = queue[queue_tail];
+    queue_tail = (queue_tail + 1) & QUEUE_MASK;
 
     /*
      * Reset the 'second byte sent' flag
@@ -124,28 +133,99 @@ static void usi_send_byte(char byte)
 
     /*
      * Set the counter value to 0x08 (16 - 8) so that it overflows after 8
-     * data bits have been sent.
+     * data bits have been sent, and clear the overflow interrupt flag so that
+     * the next interrupt can be triggered
      */
-    STATUS |= 0x08;
+    STATUS = (1 << USIOIF) | 0x08;
 
     /*
      * Enable the USI, setting it to use Timer/Counter 0 as the clock
      */
-    CONTROL |= (1 << USIOIE) | (1 << USICS0) | (0 << USIWM1) | (1 << USIWM0);
+    CONTROL = (1 << USIOIE) | (1 << USICS0) | (0 << USIWM1) | (1 << USIWM0);
+
+    /*
+     * Start the timer counter
+     */
+    TCNT0 = 0;
+
+    busy = 1;
+}
+
+ISR(USI_OVF_vect)
+{
+    /*
+     * This interrupt is triggered when the bit counter overflows.
+     * If it is not the overflow for the second byte, send the data for the
+     * second byte and set the byte counter to overflow after the next two bits
+     * are sent.
+     * Otherwise, chain the next queued byte straight after the stop bit, or
+     * set the TX port to HIGH and turn off USI if there is none.
+     */
+    if (!second_byte_sent) {
+	second_byte_sent = 1;
+	DATA = second_byte;
+
+	/*
+	 * Set the counter value to 0x0E so that it overflows after the next
+	 * two bits (16 - 0x0E) are sent.
+	 */
+	 STATUS |= 0x0E;
+    } else if (queue_head != queue_tail && !suspended) {
+	usi_send_next();
+	return;
+    } else {
+	PORTB |= (1 << TX);
+	CONTROL = 0;
+	busy = 0;
+    }
 
     /*
      * Clear the overflow interrupt flag so that the next interrupt can be
      * triggered
      */
     STATUS |= (1 << USIOIF);
+}
 
+void usi_init(void)
+{
     /*
-     * Start the timer counter
+     * Set TX to output, HIGH while idle
      */
-    TCNT0 = 0;
+    PORTB |= (1 << TX);
+    DDRB |= (1 << TX);
+    
+    /*
+     * Set the Timer/Counter 0 to CTC mode. In this mode, it will overflow when
+     * it reaches the value in OCR0A.
+     */
+    TCCR0A = (1 << WGM01);
+
+    /*
+     * Clock it at F_CPU / PRESCALER and clear it every bit time
+     */
+    TCCR0B = PRESCALER_BITS;
+    OCR0A = BIT_TICKS(PRESCALER) - 1;
+
+    sei();
+}
 
-    buffer_empty = 0;
-    while (!buffer_empty);
+void usi_send_byte(char byte)
+{
+    uint8_t head = (queue_head + 1) & QUEUE_MASK;
+
+    /*
+     * Only wait if the queue is full
+     */
+    while (head == queue_tail);
+
+    queue[queue_head] = byte;
+    queue_head = head;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+	if (!busy && !suspended) {
+	    usi_send_next();
+	}
+    }
 }
 
 void usi_send_data(const char *str)
@@ -154,3 +234,38 @@ void usi_send_data(const char *str)
 	usi_send_byte(*str++);
     }
 }
+
+void usi_send_data_P(const char *str)
+{
+    char byte;
+
+    while ((byte = pgm_read_byte(str++))) {
+	usi_send_byte(byte);
+    }
+}
+
+void usi_flush(void)
+{
+    while (busy || (queue_head != queue_tail && !suspended));
+}
+
+void usi_suspend(void)
+{
+    suspended = 1;
+
+    /*
+     * The byte being sent cannot be interrupted, so wait for its stop bit
+     */
+    while (busy);
+}
+
+void usi_resume(void)
+{
+    suspended = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+	if (!busy && queue_head != queue_tail) {
+	    usi_send_next();
+	}
+    }
+}
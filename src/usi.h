@@ -1,4 +1,4 @@
-#include <avr/io.h>
+#include <stdint.h>
 
 #ifndef USI_H
 #define USI_H
@@ -11,18 +11,51 @@
 #define TX  PB1
 #endif
 
+/*
+ * The USI is shared with the I2C backend in src/usi_twi.c, which suspends
+ * sending and claims it in two-wire mode at every START, and releases it at
+ * every STOP
+ */
 #define STATUS  USISR
 #define CONTROL USICR
 #define DATA    USIDR
 
-#if 0
-static uint8_t reverse(char b);
+/*
+ * Sets up the USI and Timer/Counter 0 for sending. Must be called once before
+ * anything is sent.
+ */
+void usi_init(void);
 
-static void usi_init(void);
-
-static void usi_send_byte(char byte);
-#endif
+/*
+ * Queues a byte to be sent, only waiting if the queue is full
+ */
+void usi_send_byte(char byte);
 
+/*
+ * Queues a string to be sent, only waiting if the queue is full
+ */
 void usi_send_data(const char *str);
 
+/*
+ * Queues a string stored in program memory to be sent, only waiting if the
+ * queue is full
+ */
+void usi_send_data_P(const char *str);
+
+/*
+ * Waits until every queued byte has been sent
+ */
+void usi_flush(void);
+
+/*
+ * Stops sending after the current byte so that the USI can be used for
+ * something else. Queued bytes are kept.
+ */
+void usi_suspend(void);
+
+/*
+ * Carries on sending the queued bytes after usi_suspend()
+ */
+void usi_resume(void);
+
 #endif
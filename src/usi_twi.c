@@ -0,0 +1,302 @@
+#include <avr/io.h>
+#include <util/delay.h>
+
+#include "i2c.h"
+#include "profile.h"
+#include "usi.h"
+
+/*
+ * The USI two-wire mode is wired to fixed pins on the ATtiny85, those of
+ * I2C_PINS in i2c.h
+ */
+#define USI_SCL PB2
+#define USI_SDA PB0
+
+/*
+ * SCL low and high periods in microseconds, the minimum of the mode set by
+ * I2C_CLOCK. The USI strobes and the wait for SCL to rise add a few cycles.
+ */
+#define T_LOW  (I2C_T_LOW_NS / 1000.0)
+#define T_HIGH (I2C_T_HIGH_NS / 1000.0)
+
+/*
+ * Status values that clear the flags and set the counter to overflow after a
+ * full byte (16 edges) or a single acknowledge bit (2 edges)
+ */
+#define STATUS_BYTE ((1 << USISIF) | (1 << USIOIF) | (1 << USIPF) | (1 << USIDC) | (0x00 << USICNT0))
+#define STATUS_BIT  ((1 << USISIF) | (1 << USIOIF) | (1 << USIPF) | (1 << USIDC) | (0x0E << USICNT0))
+
+/*
+ * Set when a slave held SCL LOW for longer than the stretch limit during the
+ * last transfer
+ */
+static uint8_t timed_out;
+
+/*
+ * Waits, for a bounded time, for SCL to go HIGH. Returns zero if a slave is
+ * still holding it LOW.
+ */
+static uint8_t scl_wait(void)
+{
+    uint8_t polls = I2C_STRETCH_LIMIT;
+
+    while (!(PINB & (1 << USI_SCL))) {
+	if (polls-- == 0) {
+	    timed_out = 1;
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+/*
+ * Shifts the data register out on SDA, and in from SDA, using software
+ * strobes of the USI clock
+ */
+static uint8_t usi_twi_transfer(uint8_t status)
+{
+    STATUS = status;
+    timed_out = 0;
+
+    do {
+	_delay_us(T_LOW);
+
+	/*
+	 * Generate a rising edge on SCL and wait for the slave to release it
+	 */
+	CONTROL |= (1 << USITC);
+	if (!scl_wait()) {
+	    break;
+	}
+	_delay_us(T_HIGH);
+
+	/*
+	 * Generate a falling edge on SCL
+	 */
+	CONTROL |= (1 << USITC);
+    } while (!(STATUS & (1 << USIOIF)));
+
+    _delay_us(T_LOW);
+
+    uint8_t byte = DATA;
+    DATA = 0xFF;
+    DDRB |= (1 << USI_SDA);
+    return byte;
+}
+
+/*
+ * Initialises the I2C
+ */
+void i2c_init()
+{
+    /*
+     * Let the UART finish the byte it is sending, then take over the USI
+     */
+    usi_suspend();
+
+    /*
+     * The USI drives the lines low from the data register and the counter,
+     * so the port must output HIGH on both pins
+     */
+    PORTB |= (1 << USI_SCL) | (1 << USI_SDA);
+    DDRB |= (1 << USI_SCL) | (1 << USI_SDA);
+
+    DATA = 0xFF;
+    CONTROL = (1 << USIWM1) | (1 << USICS1) | (1 << USICLK);
+    STATUS = STATUS_BYTE;
+}
+
+/*
+ * Starts an I2C communication
+ */
+void i2c_start()
+{
+    /*
+     * The USI may have been handed over to the UART since the last STOP,
+     * so claim it back in two-wire mode.
+     */
+    i2c_init();
+
+    scl_wait();
+    _delay_us(T_HIGH);
+
+    PORTB &= ~(1 << USI_SDA);
+    _delay_us(T_HIGH);
+    PORTB &= ~(1 << USI_SCL);
+    PORTB |= (1 << USI_SDA);
+}
+
+/*
+ * Detects an ACK
+ */
+uint8_t i2c_ack()
+{
+    DDRB &= ~(1 << USI_SDA);
+    uint8_t bit = usi_twi_transfer(STATUS_BIT);
+    return !timed_out && (bit & 0x01) == 0;
+}
+
+/*
+ * Sends a ACKM
+ */
+void i2c_ackm()
+{
+    DATA = 0x00;
+    usi_twi_transfer(STATUS_BIT);
+}
+
+/*
+ * Sends a NACKM
+ */
+void i2c_nackm()
+{
+    DATA = 0xFF;
+    usi_twi_transfer(STATUS_BIT);
+}
+
+/*
+ * Stops an I2C communication
+ */
+void i2c_stop()
+{
+    PORTB &= ~(1 << USI_SDA);
+    PORTB |= (1 << USI_SCL);
+    scl_wait();
+    _delay_us(T_HIGH);
+    PORTB |= (1 << USI_SDA);
+    _delay_us(T_LOW);
+
+    /*
+     * Release the USI and the bus so that the UART can use the USI until
+     * the next START
+     */
+    CONTROL = 0;
+    STATUS = STATUS_BYTE;
+    DDRB &= ~((1 << USI_SCL) | (1 << USI_SDA));
+    usi_resume();
+}
+
+/*
+ * Frees the bus from a slave holding SDA LOW, then stops
+ */
+uint8_t i2c_recover()
+{
+    i2c_init();
+
+    /*
+     * Clock SCL from the port. The data register shifts in on every rising
+     * edge, so keep it full of ones to leave SDA released.
+     */
+    for (uint8_t i = 0; i < 9 && !(PINB & (1 << USI_SDA)); i++) {
+	PORTB &= ~(1 << USI_SCL);
+	DATA = 0xFF;
+	_delay_us(T_LOW);
+	PORTB |= (1 << USI_SCL);
+	scl_wait();
+	_delay_us(T_HIGH);
+    }
+
+    PORTB &= ~(1 << USI_SCL);
+    DATA = 0xFF;
+    _delay_us(T_LOW);
+    i2c_stop();
+    return (PINB & (1 << USI_SDA)) && (PINB & (1 << USI_SCL));
+}
+
+/*
+ * Writes a byte to the I2C channel and updates the state of the application
+ */
+void i2c_write(struct i2c_write_data *data, enum i2c_state *state)
+{
+    switch (data->state) {
+	case W_NONE:
+	    break;
+
+	case W_WRITE:
+	    /*
+	     * The USI shifts the whole byte out in one go
+	     */
+	    PORTB &= ~(1 << USI_SCL);
+	    DATA = data->byte;
+	    usi_twi_transfer(STATUS_BYTE);
+	    data->bit_counter = 0;
+
+	    if (!timed_out && i2c_ack()) {
+		data->state = W_ACKS;
+	    } else {
+		data->state = W_ERROR;
+	    }
+	    break;
+
+	case W_ACKS:
+	    PROFILE_COUNT(PROFILE_BYTES);
+	    data->state = W_NONE;
+	    *state = data->success_state;
+	    break;
+
+	case W_ERROR:
+	    PROFILE_COUNT(PROFILE_BYTES);
+	    PROFILE_COUNT(PROFILE_NAKS);
+	    data->state = W_NONE;
+	    *state = data->error_state;
+	    break;
+
+	default:
+	    break;
+    }
+}
+
+/*
+ * Reads a byte from the I2C channel and updates the state of the application
+ */
+void i2c_read(struct i2c_read_data *data, enum i2c_state *state)
+{
+    switch (data->state) {
+	case R_NONE:
+	    break;
+
+	case R_READ:
+	    DDRB &= ~(1 << USI_SDA);
+	    data->byte = 0;
+	    data->state = R_READING;
+	    break;
+
+	case R_READING:
+	    /*
+	     * The USI shifts the whole byte in in one go
+	     */
+	    data->byte = usi_twi_transfer(STATUS_BYTE);
+	    data->bit_counter = 8;
+
+	    if (timed_out) {
+		data->state = R_ERROR;
+	    } else if (data->send_nack) {
+		data->state = R_NACKM;
+	    } else {
+		data->state = R_ACKM;
+	    }
+	    break;
+
+	case R_NACKM:
+	    PROFILE_COUNT(PROFILE_BYTES);
+	    i2c_nackm();
+	    data->state = R_NONE;
+	    *state = data->success_state;
+	    break;
+
+	case R_ACKM:
+	    PROFILE_COUNT(PROFILE_BYTES);
+	    i2c_ackm();
+	    data->state = R_NONE;
+	    *state = data->success_state;
+	    break;
+
+	case R_ERROR:
+	    data->state = R_NONE;
+	    *state = data->error_state;
+	    break;
+	    
+	default:
+	    break;
+    }
+}